@@ -0,0 +1,70 @@
+// alloccounter.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Replaces the global operator new to count allocations. Every benchmark
+* executable is linked with this file.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "benchutils.hpp"
+
+static std::atomic<unsigned long> allocation_count(0);
+
+unsigned long allocationCount()
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,121 @@
+// bench_protocol.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Measures encoding and decoding of the protocol stack, for message strings
+* from 0 bytes to 32 KiB.
+*/
+
+#include "msglayer.hpp"
+#include "neartypes.hpp"
+
+#include "benchutils.hpp"
+
+using namespace nuke_ms;
+
+
+int main()
+{
+    const std::size_t sizes[] = {0, 16, 256, 1024, 4096, 16384, 32768};
+
+    // decoding the segmentation header does not depend on the payload
+    {
+        const unsigned long iterations = 1ul << 20;
+        byte_traits::byte_sequence header(
+            SegmentationLayerBase::max_header_length);
+        SegmentationLayerBase::encodeHeader(
+            header.begin(), SegmentationLayerBase::makeHeader(100));
+
+        std::size_t sum = 0;
+        runBenchmark("SegmentationLayerBase::decodeHeader", iterations, [&]() {
+            for (unsigned long i = 0; i < iterations; ++i)
+                sum += SegmentationLayerBase::decodeHeader(
+                    header.begin()).packetsize;
+        }, SegmentationLayerBase::v0_header_length);
+
+        // use the result, so the loop is not optimized away
+        if (sum == 0)
+            std::cout<<"unexpected result"<<std::endl;
+    }
+
+    for (std::size_t size : sizes)
+    {
+        // process roughly the same amount of data for every size
+        const unsigned long iterations = (1ul << 24) / (size + 64);
+
+        std::string suffix = " (" + std::to_string(size) + " bytes)";
+
+        SegmentationLayer<NearUserMessage> packet(
+            NearUserMessage(
+                StringwrapLayer(byte_traits::msg_string(size, 'x')),
+                UniqueUserID(1ull), UniqueUserID(2ull), 3
+            )
+        );
+
+        auto buffer = std::make_shared<byte_traits::byte_sequence>(
+            packet.size());
+        packet.fillSerialized(buffer->begin());
+
+        std::size_t header_length =
+            SegmentationLayerBase::decodeHeader(buffer->begin()).headerLength();
+
+        // the serialized NearUserMessage, without the segmentation header
+        SerializedData body(
+            buffer,
+            buffer->begin() + header_length,
+            packet.size() - header_length
+        );
+
+        // the serialized message string
+        SerializedData string_data(
+            buffer,
+            buffer->begin() + header_length + NearUserMessage::header_length,
+            size
+        );
+
+        runBenchmark("SegmentationLayer::fillSerialized" + suffix, iterations,
+            [&]() {
+                for (unsigned long i = 0; i < iterations; ++i)
+                    packet.fillSerialized(buffer->begin());
+            },
+            packet.size()
+        );
+
+        runBenchmark("NearUserMessage(SerializedData)" + suffix, iterations,
+            [&]() {
+                for (unsigned long i = 0; i < iterations; ++i)
+                    NearUserMessage decoded(body);
+            },
+            body.size()
+        );
+
+        byte_traits::byte_sequence string_buffer(size);
+        runBenchmark("StringwrapLayer round trip" + suffix, iterations,
+            [&]() {
+                for (unsigned long i = 0; i < iterations; ++i)
+                {
+                    StringwrapLayer decoded(string_data);
+                    decoded.fillSerialized(string_buffer.begin());
+                }
+            },
+            size
+        );
+    }
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+// bench_refcounter.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Compares the atomic ReferenceCounter with the mutex based implementation
+* it replaced. Handlers of asynchronous operations are bound together with a
+* CountedReference, which is copied several times until the handler is run,
+* so the cost of a copy is part of every handler dispatch.
+*/
+
+#include <boost/asio/io_service.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "refcounter.hpp"
+
+#include "benchutils.hpp"
+
+
+/** The mutex based reference counter, as it was before it used atomics. */
+template <typename ReferencedType>
+class MutexReferenceCounter
+{
+    boost::function<void ()> action;
+    unsigned reference_count;
+    boost::mutex reference_mutex;
+
+public:
+    class CountedReference
+    {
+        MutexReferenceCounter& referencecounter;
+
+    public:
+        CountedReference(MutexReferenceCounter& _referencecounter)
+            : referencecounter(_referencecounter)
+        { referencecounter.increaseRefCount(); }
+
+        CountedReference(const CountedReference& other)
+            : referencecounter(other.referencecounter)
+        { referencecounter.increaseRefCount(); }
+
+        ~CountedReference()
+        { referencecounter.decreaseRefCount(); }
+
+        ReferencedType& ref()
+        { return static_cast<ReferencedType&>(referencecounter); }
+    };
+
+protected:
+    MutexReferenceCounter(
+        boost::function<void ()> _action = boost::function<void ()>()
+    )
+        : action(_action), reference_count(0u)
+    {}
+
+private:
+    void increaseRefCount()
+    {
+        boost::mutex::scoped_lock lock(reference_mutex);
+        ++reference_count;
+    }
+
+    void decreaseRefCount()
+    {
+        bool reached_zero;
+        {
+            boost::mutex::scoped_lock lock(reference_mutex);
+            reached_zero = (--reference_count == 0u);
+        }
+
+        if (reached_zero && action)
+            action();
+    }
+};
+
+
+/** An object whose references are counted, like a RemotePeer. */
+template <template <typename> class Counter>
+struct Referenced : public Counter<Referenced<Counter> >
+{
+    unsigned long handled;
+
+    Referenced() : handled(0) {}
+
+    static void handler(
+        typename Counter<Referenced<Counter> >::CountedReference reference
+    )
+    { ++reference.ref().handled; }
+};
+
+
+/** Create and destroy references on a single thread */
+template <template <typename> class Counter>
+void copyReferences(unsigned long count)
+{
+    Referenced<Counter> object;
+
+    for (unsigned long i = 0; i < count; ++i)
+    {
+        typename Counter<Referenced<Counter> >::CountedReference ref(object);
+        typename Counter<Referenced<Counter> >::CountedReference copy(ref);
+    }
+}
+
+/** Post handlers bound to a reference and run them on several threads */
+template <template <typename> class Counter>
+void dispatchHandlers(unsigned long count, unsigned threads)
+{
+    Referenced<Counter> object;
+    boost::asio::io_service io_service;
+
+    for (unsigned long i = 0; i < count; ++i)
+        io_service.post(boost::bind(
+            &Referenced<Counter>::handler,
+            typename Counter<Referenced<Counter> >::CountedReference(object)
+        ));
+
+    boost::thread_group thread_group;
+    for (unsigned i = 1; i < threads; ++i)
+        thread_group.create_thread(
+            boost::bind(&boost::asio::io_service::run, &io_service));
+
+    io_service.run();
+    thread_group.join_all();
+}
+
+/** Create and destroy references to the same object on several threads */
+template <template <typename> class Counter>
+void contendReferences(unsigned long count, unsigned threads)
+{
+    Referenced<Counter> object;
+
+    auto work = [&object, count, threads]() {
+        for (unsigned long i = 0; i < count / threads; ++i)
+        {
+            typename Counter<Referenced<Counter> >::CountedReference
+                ref(object);
+        }
+    };
+
+    boost::thread_group thread_group;
+    for (unsigned i = 0; i < threads; ++i)
+        thread_group.create_thread(work);
+
+    thread_group.join_all();
+}
+
+
+int main()
+{
+    const unsigned long copies = 10000000ul;
+    const unsigned long handlers = 1000000ul;
+    const unsigned threads = 4;
+
+    runBenchmark("copy reference, mutex", copies,
+        [=]() { copyReferences<MutexReferenceCounter>(copies); });
+    runBenchmark("copy reference, atomic", copies,
+        [=]() { copyReferences<ReferenceCounter>(copies); });
+
+    runBenchmark("dispatch handler, 1 thread, mutex", handlers,
+        [=]() { dispatchHandlers<MutexReferenceCounter>(handlers, 1); });
+    runBenchmark("dispatch handler, 1 thread, atomic", handlers,
+        [=]() { dispatchHandlers<ReferenceCounter>(handlers, 1); });
+
+    runBenchmark("dispatch handler, 4 threads, mutex", handlers,
+        [=]() { dispatchHandlers<MutexReferenceCounter>(handlers, threads); });
+    runBenchmark("dispatch handler, 4 threads, atomic", handlers,
+        [=]() { dispatchHandlers<ReferenceCounter>(handlers, threads); });
+
+    runBenchmark("contended reference, 4 threads, mutex", copies,
+        [=]() { contendReferences<MutexReferenceCounter>(copies, threads); });
+    runBenchmark("contended reference, 4 threads, atomic", copies,
+        [=]() { contendReferences<ReferenceCounter>(copies, threads); });
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+// bench_stringwrap.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Compares encoding and decoding a StringwrapLayer with the character by
+* character conversion it used before.
+*/
+
+#include "msglayer.hpp"
+
+#include "benchutils.hpp"
+
+using namespace nuke_ms;
+
+
+int main()
+{
+    for (std::size_t size : {16u, 1024u, 32768u})
+    {
+        // process the same amount of data for every size
+        const unsigned long iterations = (1ul << 22) / size;
+
+        StringwrapLayer msg(byte_traits::msg_string(size, 'x'));
+        auto buffer = std::make_shared<byte_traits::byte_sequence>(size);
+        SerializedData data(buffer, buffer->begin(), size);
+
+        std::string suffix = ", " + std::to_string(size) + " bytes";
+
+        runBenchmark("encode, per character" + suffix, iterations, [&]() {
+            for (unsigned long i = 0; i < iterations; ++i)
+            {
+                auto it = buffer->begin();
+                for (char c : msg._message_string)
+                    it = writebytes(it, to_netbo(c));
+            }
+        }, size);
+
+        runBenchmark("encode, writesequence" + suffix, iterations, [&]() {
+            for (unsigned long i = 0; i < iterations; ++i)
+                msg.fillSerialized(buffer->begin());
+        }, size);
+
+        runBenchmark("decode, per character" + suffix, iterations, [&]() {
+            for (unsigned long i = 0; i < iterations; ++i)
+            {
+                byte_traits::msg_string str(size, '\0');
+                auto out = str.begin();
+                char c;
+                for (auto it = buffer->cbegin(); it != buffer->cend(); )
+                {
+                    it = readbytes(&c, it);
+                    *out++ = to_hostbo(c);
+                }
+            }
+        }, size);
+
+        runBenchmark("decode, readsequence" + suffix, iterations, [&]() {
+            for (unsigned long i = 0; i < iterations; ++i)
+                StringwrapLayer decoded(data);
+        }, size);
+    }
+
+    return 0;
+}
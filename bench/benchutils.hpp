@@ -0,0 +1,97 @@
+// benchutils.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCHUTILS_HPP
+#define BENCHUTILS_HPP
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+
+/** Return the number of calls to operator new since the program started.
+* Defined in alloccounter.cpp, which replaces the global operator new.
+*/
+unsigned long allocationCount();
+
+
+/** Results of a benchmark run */
+struct BenchmarkResult
+{
+    double ns_per_op; /**< Time per operation in nanoseconds */
+    double bytes_per_s; /**< Throughput, 0 if no byte count was given */
+    double allocs_per_op; /**< Calls to operator new per operation */
+};
+
+/** Run a benchmark and print the time per operation, the throughput and the
+* number of allocations per operation.
+*
+* @param name Name of the benchmark, printed in the first column.
+* @param operations Number of operations that one call of func performs.
+* @param func The function to measure. It is called once to warm up, and once
+* for the measurement.
+* @param bytes_per_op Number of bytes one operation processes. If nonzero,
+* the throughput is printed as well.
+* @returns The results of the measurement.
+*/
+template <typename Function>
+BenchmarkResult runBenchmark(
+    const std::string& name,
+    unsigned long operations,
+    Function func,
+    std::size_t bytes_per_op = 0
+)
+{
+    typedef std::chrono::steady_clock clock;
+
+    // warm up caches and pools
+    func();
+
+    unsigned long allocs_before = allocationCount();
+    clock::time_point start = clock::now();
+    func();
+    clock::time_point end = clock::now();
+    unsigned long allocs_after = allocationCount();
+
+    BenchmarkResult result;
+    result.ns_per_op =
+        std::chrono::duration<double, std::nano>(end - start).count()
+        / operations;
+    result.bytes_per_s =
+        result.ns_per_op > 0 ? bytes_per_op * 1e9 / result.ns_per_op : 0;
+    result.allocs_per_op =
+        static_cast<double>(allocs_after - allocs_before) / operations;
+
+    std::cout<<std::left<<std::setw(48)<<name<<std::right<<std::fixed<<
+        std::setprecision(1)<<std::setw(12)<<result.ns_per_op<<" ns/op";
+
+    if (bytes_per_op)
+        std::cout<<std::setw(10)<<result.bytes_per_s / (1024 * 1024)<<" MiB/s";
+    else
+        std::cout<<std::setw(16)<<"";
+
+    std::cout<<std::setprecision(2)<<std::setw(10)<<result.allocs_per_op<<
+        " allocs/op"<<std::endl;
+
+    return result;
+}
+
+
+#endif // ifndef BENCHUTILS_HPP
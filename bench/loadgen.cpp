@@ -0,0 +1,533 @@
+// loadgen.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Load generator for the dispatching server.
+*
+* Opens many connections to a running nuke-ms-serv, lets some of them send
+* NearUserMessages at a fixed rate and measures how long it takes until the
+* server has delivered them to the other connections. Every message carries
+* the time it was sent in the first bytes of its string, so the latency can
+* be computed on arrival.
+*
+* Start the server first, then run for example
+*     loadgen -c 1000 -s 10 -r 100 -m 256 -d 10
+* Many connections need a high enough limit of open files (ulimit -n) for
+* both processes.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "neartypes.hpp"
+#include "segmentationreader.hpp"
+
+using namespace nuke_ms;
+using boost::asio::ip::tcp;
+
+typedef std::chrono::steady_clock clock_type;
+
+
+/** Options of a load generator run */
+struct LoadOptions
+{
+    std::string host;
+    unsigned short port;
+    unsigned connections; /**< Number of connections to open */
+    unsigned senders; /**< Number of connections that send messages */
+    double rate; /**< Messages per second and sender */
+    std::size_t message_size; /**< Length of the message string */
+    unsigned duration; /**< Seconds to send messages */
+    unsigned threads; /**< Number of threads running the io_service */
+
+    LoadOptions()
+        : host("127.0.0.1"), port(34443), connections(100), senders(1),
+        rate(100.), message_size(64), duration(10), threads(1)
+    {}
+};
+
+
+/** Histogram of latencies with logarithmic buckets.
+* Every power of two is divided into 32 buckets, so a recorded value is
+* reported with an error of at most about 3 percent.
+* Recording is thread safe.
+*/
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+    {
+        for (auto& bucket : buckets)
+            bucket.store(0, std::memory_order_relaxed);
+    }
+
+    void record(unsigned long long value)
+    {
+        buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    unsigned long long count() const
+    {
+        unsigned long long total = 0;
+        for (auto& bucket : buckets)
+            total += bucket.load(std::memory_order_relaxed);
+
+        return total;
+    }
+
+    /** Return the value below which the given fraction of values lies */
+    unsigned long long percentile(double fraction) const
+    {
+        unsigned long long total = count();
+        if (total == 0)
+            return 0;
+
+        unsigned long long rank = std::min(
+            static_cast<unsigned long long>(fraction * total), total - 1);
+        unsigned long long seen = 0;
+
+        for (unsigned i = 0; i < bucket_count; ++i)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen > rank)
+                return bucketValue(i);
+        }
+
+        return 0;
+    }
+
+private:
+    static constexpr unsigned sub_bits = 5;
+    static constexpr unsigned sub_count = 1u << sub_bits;
+    static constexpr unsigned bucket_count = 64u << sub_bits;
+
+    std::atomic<unsigned long long> buckets[bucket_count];
+
+    static unsigned bucketIndex(unsigned long long value)
+    {
+        if (value < sub_count)
+            return static_cast<unsigned>(value);
+
+        unsigned exponent = sub_bits;
+        while (value >> (exponent + 1))
+            ++exponent;
+        unsigned mantissa = (value >> (exponent - sub_bits)) & (sub_count - 1);
+
+        return ((exponent - sub_bits + 1) << sub_bits) + mantissa;
+    }
+
+    // middle of the range of values in a bucket
+    static unsigned long long bucketValue(unsigned index)
+    {
+        if (index < sub_count)
+            return index;
+
+        unsigned exponent = (index >> sub_bits) + sub_bits - 1;
+        unsigned long long mantissa = index & (sub_count - 1);
+        unsigned long long width = 1ull << (exponent - sub_bits);
+
+        return ((sub_count + mantissa) << (exponent - sub_bits)) + width / 2;
+    }
+};
+
+
+/** State shared by all connections */
+struct LoadState
+{
+    const LoadOptions& options;
+    boost::asio::io_service io_service;
+
+    std::atomic<unsigned> connected;
+    std::atomic<unsigned> failed;
+    std::atomic<bool> sending;
+
+    std::atomic<unsigned long long> sent;
+    std::atomic<unsigned long long> delivered;
+    std::atomic<unsigned long long> delivered_bytes;
+
+    /** Number of times a sender could not keep up with its rate */
+    std::atomic<unsigned long long> late;
+
+    LatencyHistogram latency;
+
+    LoadState(const LoadOptions& options_)
+        : options(options_), connected(0), failed(0), sending(false),
+        sent(0), delivered(0), delivered_bytes(0), late(0)
+    {}
+};
+
+
+/** One connection to the server */
+class Connection : public std::enable_shared_from_this<Connection>
+{
+public:
+    Connection(LoadState& state_, unsigned index_)
+        : state(state_), index(index_), socket(state_.io_service),
+        strand(state_.io_service), timer(state_.io_service),
+        reader(0xFFFF), writing(false)
+    {
+        // serialize the message once, only the time stamp changes
+        SegmentationLayer<NearUserMessage> packet(
+            NearUserMessage(
+                StringwrapLayer(byte_traits::msg_string(
+                    state.options.message_size, 'x')),
+                UniqueUserID::user_id_none,
+                UniqueUserID(static_cast<unsigned long long>(index + 1)),
+                0
+            )
+        );
+
+        send_buffer.resize(packet.size());
+        packet.fillSerialized(send_buffer.begin());
+    }
+
+    /** Offset of the time stamp in a packet. The packets are small, so they
+    * have a version 0 header. */
+    static constexpr std::size_t timestamp_offset =
+        SegmentationLayerBase::v0_header_length +
+        NearUserMessage::header_length;
+
+    /** Maximum length of the message string, longer messages would not fit
+    * into a packet with a version 0 header. */
+    static constexpr std::size_t max_message_size =
+        (std::numeric_limits<byte_traits::uint2b_t>::max() - timestamp_offset)
+        / sizeof(byte_traits::msg_string::value_type);
+
+    void connect(const tcp::endpoint& endpoint)
+    {
+        socket.async_connect(endpoint, strand.wrap(boost::bind(
+            &Connection::connectHandler, shared_from_this(),
+            boost::asio::placeholders::error
+        )));
+    }
+
+    /** Start sending messages, the first one after the given delay */
+    void startSending(clock_type::duration delay)
+    {
+        next_send = clock_type::now() + delay;
+        strand.post(boost::bind(&Connection::scheduleSend, shared_from_this()));
+    }
+
+    void close()
+    {
+        strand.post(boost::bind(&Connection::closeSocket, shared_from_this()));
+    }
+
+private:
+    LoadState& state;
+    const unsigned index;
+    tcp::socket socket;
+    boost::asio::io_service::strand strand;
+    boost::asio::steady_timer timer;
+    SegmentationStreamReader reader;
+
+    byte_traits::byte_sequence send_buffer;
+    bool writing;
+    clock_type::time_point next_send;
+
+    void connectHandler(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            if (!state.failed++)
+                std::cerr<<"Connecting failed: "<<error.message()<<std::endl;
+            return;
+        }
+
+        socket.set_option(tcp::no_delay(true));
+        ++state.connected;
+        startReceive();
+    }
+
+    void startReceive()
+    {
+        socket.async_read_some(reader.prepare(), strand.wrap(boost::bind(
+            &Connection::receiveHandler, shared_from_this(),
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::bytes_transferred
+        )));
+    }
+
+    void receiveHandler(
+        const boost::system::error_code& error,
+        std::size_t bytes_transferred
+    )
+    {
+        if (error)
+            return;
+
+        clock_type::time_point now = clock_type::now();
+        reader.commit(bytes_transferred);
+
+        SerializedData packet({}, {}, 0);
+        while (reader.nextPacket(packet))
+        {
+            if (packet.size() < timestamp_offset + sizeof(long long))
+                continue;
+
+            long long timestamp;
+            readbytes(&timestamp, packet.begin() + timestamp_offset);
+
+            clock_type::duration latency =
+                now - clock_type::time_point(clock_type::duration(timestamp));
+
+            state.latency.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    latency).count());
+            ++state.delivered;
+            state.delivered_bytes += packet.size();
+        }
+
+        startReceive();
+    }
+
+    void scheduleSend()
+    {
+        timer.expires_at(next_send);
+        timer.async_wait(strand.wrap(boost::bind(
+            &Connection::sendTimerHandler, shared_from_this(),
+            boost::asio::placeholders::error
+        )));
+    }
+
+    void sendTimerHandler(const boost::system::error_code& error)
+    {
+        if (error || !state.sending)
+            return;
+
+        next_send += std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(1. / state.options.rate));
+
+        // the previous message is still being written
+        if (writing)
+            ++state.late;
+        else
+            send();
+
+        scheduleSend();
+    }
+
+    void send()
+    {
+        long long timestamp = clock_type::now().time_since_epoch().count();
+        writebytes(send_buffer.begin() + timestamp_offset, timestamp);
+
+        writing = true;
+        ++state.sent;
+
+        boost::asio::async_write(
+            socket,
+            boost::asio::buffer(send_buffer),
+            strand.wrap(boost::bind(
+                &Connection::writeHandler, shared_from_this(),
+                boost::asio::placeholders::error
+            ))
+        );
+    }
+
+    void writeHandler(const boost::system::error_code& error)
+    {
+        writing = false;
+
+        if (error)
+            std::cerr<<"Sending failed: "<<error.message()<<std::endl;
+    }
+
+    void closeSocket()
+    {
+        boost::system::error_code dontcare;
+        timer.cancel(dontcare);
+        socket.close(dontcare);
+    }
+};
+
+
+/** Parse an unsigned number, return false on error */
+template <typename T>
+static bool parseNumber(const char* str, T& value)
+{
+    char* end;
+    double parsed = std::strtod(str, &end);
+
+    if (*end != '\0' || parsed < 0)
+        return false;
+
+    value = static_cast<T>(parsed);
+    return true;
+}
+
+/** Parse the command line into the load options.
+* Accepted arguments are:
+*   -h, --host ADDRESS    Address of the server (default: 127.0.0.1)
+*   -p, --port N          Port of the server (default: 34443)
+*   -c, --connections N   Number of connections (default: 100)
+*   -s, --senders N       Number of sending connections (default: 1)
+*   -r, --rate N          Messages per second and sender (default: 100)
+*   -m, --message-size N  Length of the message strings (default: 64)
+*   -d, --duration N      Seconds to send messages (default: 10)
+*   -t, --threads N       Number of event loop threads (default: 1)
+*
+* @return true on success, false if the arguments could not be parsed.
+*/
+static bool parseCommandLine(int argc, char* argv[], LoadOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (++i == argc)
+            return false;
+
+        bool ok;
+        if (arg == "-h" || arg == "--host")
+        {
+            options.host = argv[i];
+            ok = true;
+        }
+        else if (arg == "-p" || arg == "--port")
+            ok = parseNumber(argv[i], options.port);
+        else if (arg == "-c" || arg == "--connections")
+            ok = parseNumber(argv[i], options.connections);
+        else if (arg == "-s" || arg == "--senders")
+            ok = parseNumber(argv[i], options.senders);
+        else if (arg == "-r" || arg == "--rate")
+            ok = parseNumber(argv[i], options.rate);
+        else if (arg == "-m" || arg == "--message-size")
+            ok = parseNumber(argv[i], options.message_size);
+        else if (arg == "-d" || arg == "--duration")
+            ok = parseNumber(argv[i], options.duration);
+        else if (arg == "-t" || arg == "--threads")
+            ok = parseNumber(argv[i], options.threads);
+        else
+            ok = false;
+
+        if (!ok)
+            return false;
+    }
+
+    // the time stamp needs room in the message string
+    if (options.message_size < sizeof(long long))
+        options.message_size = sizeof(long long);
+
+    return options.message_size <= Connection::max_message_size
+        && options.connections > 0 && options.senders <= options.connections
+        && options.rate > 0 && options.threads > 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    LoadOptions options;
+
+    if (!parseCommandLine(argc, argv, options))
+    {
+        std::cerr<<"Usage: "<<argv[0]<<" [-h|--host ADDRESS] [-p|--port N] "
+            "[-c|--connections N] [-s|--senders N] [-r|--rate N] "
+            "[-m|--message-size N] [-d|--duration N] [-t|--threads N]\n"
+            "The message size can be at most "<<Connection::max_message_size
+            <<".\n";
+        return 1;
+    }
+
+    LoadState state(options);
+    tcp::endpoint endpoint(
+        boost::asio::ip::address::from_string(options.host), options.port);
+
+    // keep the io_service running until we are done
+    std::unique_ptr<boost::asio::io_service::work> work(
+        new boost::asio::io_service::work(state.io_service));
+
+    boost::thread_group threads;
+    for (unsigned i = 0; i < options.threads; ++i)
+        threads.create_thread(
+            boost::bind(&boost::asio::io_service::run, &state.io_service));
+
+    // connect everybody
+    std::vector<std::shared_ptr<Connection>> connections;
+    for (unsigned i = 0; i < options.connections; ++i)
+    {
+        connections.push_back(std::make_shared<Connection>(state, i));
+        connections.back()->connect(endpoint);
+    }
+
+    while (state.connected + state.failed < options.connections)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
+    std::cout<<"Connected "<<state.connected<<" of "<<options.connections<<
+        " connections."<<std::endl;
+
+    // give the server time to register all connections
+    boost::this_thread::sleep(boost::posix_time::milliseconds(500));
+
+    // spread the senders evenly over one send interval
+    state.sending = true;
+    clock_type::time_point start = clock_type::now();
+
+    for (unsigned i = 0; i < options.senders; ++i)
+        connections[i]->startSending(
+            std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::duration<double>(
+                    i / (options.rate * options.senders))));
+
+    boost::this_thread::sleep(boost::posix_time::seconds(options.duration));
+    state.sending = false;
+    double elapsed = std::chrono::duration<double>(
+        clock_type::now() - start).count();
+
+    // let the last messages arrive
+    boost::this_thread::sleep(boost::posix_time::seconds(1));
+
+    for (auto& connection : connections)
+        connection->close();
+
+    work.reset();
+    threads.join_all();
+
+    // report
+    // the server does not send a message back to its sender
+    unsigned long long expected =
+        state.sent * (state.connected ? state.connected - 1 : 0);
+
+    std::cout<<std::fixed<<std::setprecision(1)<<
+        "Messages sent:       "<<state.sent<<" ("<<
+            state.sent / elapsed<<"/s, "<<state.late<<" late)\n"<<
+        "Messages delivered:  "<<state.delivered<<" of "<<expected<<" ("<<
+            state.delivered / elapsed<<"/s, "<<
+            state.delivered_bytes / elapsed / (1024 * 1024)<<" MiB/s)\n"<<
+        std::setprecision(3)<<
+        "Latency p50:         "<<state.latency.percentile(0.5) / 1e3<<" us\n"<<
+        "Latency p99:         "<<state.latency.percentile(0.99) / 1e3<<" us\n"<<
+        "Latency p999:        "<<state.latency.percentile(0.999) / 1e3<<" us\n"<<
+        "Latency max:         "<<state.latency.percentile(1.) / 1e3<<" us\n";
+
+    return state.failed || state.delivered < expected ? 2 : 0;
+}
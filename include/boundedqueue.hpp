@@ -0,0 +1,178 @@
+// boundedqueue.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file boundedqueue.hpp
+* @ingroup common
+* @brief Lock free queue with a fixed capacity
+*/
+
+#ifndef BOUNDEDQUEUE_HPP_INCLUDED
+#define BOUNDEDQUEUE_HPP_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <stdexcept>
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Lock free queue with a fixed capacity.
+*
+* Any number of threads may push and pop concurrently. Neither operation ever
+* blocks or allocates memory: push() fails if the queue is full, pop() fails
+* if it is empty.
+*
+* The queue is a ring buffer of cells. Every cell carries a sequence number
+* that tells producers and consumers whether it is their turn to use the cell,
+* so a thread only has to win one compare-and-swap on the head or tail
+* position to own a cell.
+*
+* @tparam T Type of the elements. Must be default constructible and move
+* assignable.
+*/
+template <typename T>
+class BoundedQueue
+{
+public:
+    /** Constructor.
+    * @param capacity Maximum number of elements, must be a power of two.
+    * @throws std::invalid_argument if the capacity is not a power of two.
+    */
+    explicit BoundedQueue(std::size_t capacity)
+        : mask(capacity - 1), cells(new Cell[capacity]), head(0), tail(0)
+    {
+        if (capacity < 2 || (capacity & mask) != 0)
+            throw std::invalid_argument(
+                "Capacity of BoundedQueue must be a power of two");
+
+        for (std::size_t i = 0; i < capacity; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /** Append an element.
+    * @param value The element, it is moved into the queue on success.
+    * @returns true on success, false if the queue was full.
+    */
+    bool push(T& value)
+    {
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        for (;;)
+        {
+            cell = &cells[pos & mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff =
+                static_cast<std::ptrdiff_t>(sequence - pos);
+
+            // the cell is free, try to claim it
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            // the cell still holds an element from one round ago: full
+            else if (diff < 0)
+                return false;
+            // another producer was faster
+            else
+                pos = tail.load(std::memory_order_relaxed);
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /** Remove the oldest element.
+    * @param value Will be assigned the element on success.
+    * @returns true on success, false if the queue was empty.
+    */
+    bool pop(T& value)
+    {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        for (;;)
+        {
+            cell = &cells[pos & mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff =
+                static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+
+            // the cell holds an element, try to claim it
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            // nothing was written to the cell yet: empty
+            else if (diff < 0)
+                return false;
+            // another consumer was faster
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+
+        value = std::move(cell->value);
+
+        // free the cell for the producers of the next round
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /** Return the capacity of the queue */
+    std::size_t capacity() const
+    { return mask + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    /** Size of a cache line, used to keep head and tail apart */
+    static constexpr std::size_t cache_line_size = 64;
+
+    const std::size_t mask;
+    std::unique_ptr<Cell[]> cells;
+
+    alignas(cache_line_size) std::atomic<std::size_t> head;
+    alignas(cache_line_size) std::atomic<std::size_t> tail;
+
+    // no copy construction allowed
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator= (const BoundedQueue&) = delete;
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef BOUNDEDQUEUE_HPP_INCLUDED
@@ -0,0 +1,202 @@
+// bufferpool.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file bufferpool.hpp
+* @ingroup common
+* @brief Pool of recycled byte buffers
+*
+* Every received packet needs a buffer for its body. Allocating a fresh
+* byte_traits::byte_sequence for each packet costs an allocation and, because
+* std::vector value-initializes its elements, a pass over the whole buffer that
+* only writes zeros, which are overwritten by the received data right away.
+*
+* The BufferPool hands out buffers that were used before. They are sorted into
+* size classes (powers of two), and their contents are not initialized. A
+* buffer is returned to the pool automatically when the last std::shared_ptr
+* to it is destroyed, so it fits right into the ownership model of
+* SerializedData.
+*/
+
+#ifndef BUFFERPOOL_HPP_INCLUDED
+#define BUFFERPOOL_HPP_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+
+#include "bytes.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Pool of recycled byte buffers.
+*
+* Use acquire() to get a buffer. The returned buffer is at least as large as
+* requested, usually larger: its size() is the size of its size class. So
+* always keep track of the number of bytes you actually use, don't rely on
+* the size of the buffer.
+*
+* The pool must be managed by a std::shared_ptr, buffers that are handed out
+* keep the pool alive.
+*
+* This class is thread safe.
+*/
+class BufferPool : public std::enable_shared_from_this<BufferPool>
+{
+public:
+    /** Type of a buffer handed out by the pool */
+    typedef std::shared_ptr<byte_traits::byte_sequence> buffer_ptr_t;
+
+    /** Size of the smallest size class */
+    static constexpr std::size_t min_class_size = 64;
+
+    /** Number of size classes, each one twice as big as the one before */
+    static constexpr unsigned class_count = 11;
+
+    /** Size of the largest size class. Larger buffers are not pooled. */
+    static constexpr std::size_t max_class_size =
+        min_class_size << (class_count - 1);
+
+    /** Constructor.
+    * @param max_free_buffers Maximum number of unused buffers that are kept
+    * per size class. Buffers that are released when the size class is full
+    * are deleted.
+    */
+    explicit BufferPool(std::size_t max_free_buffers = 64);
+
+    /** Destructor, deletes all unused buffers. */
+    ~BufferPool();
+
+    /** Counters of the pool */
+    struct Statistics
+    {
+        unsigned long long acquired;  /**< Number of buffers handed out */
+        unsigned long long allocated; /**< Number of buffers allocated */
+    };
+
+    /** Get the process wide buffer pool. */
+    static std::shared_ptr<BufferPool> instance();
+
+    /** Get a buffer.
+    * The contents of the buffer are unspecified. The buffer is returned to
+    * the pool when the last reference to it is destroyed.
+    *
+    * @param size Minimal size of the buffer in bytes
+    * @returns A buffer with a size of at least size bytes.
+    */
+    buffer_ptr_t acquire(std::size_t size);
+
+    /** Return the counters of the pool.
+    * The more acquired buffers were recycled, the smaller the number of
+    * allocated buffers is compared to the number of acquired buffers.
+    */
+    Statistics statistics() const;
+
+private:
+    /** Returns a buffer to the pool, used as deleter for buffer_ptr_t.
+    * The pool is kept alive by the allocator of the control block.
+    */
+    struct Recycler
+    {
+        BufferPool* pool;
+        unsigned size_class;
+
+        void operator() (byte_traits::byte_sequence* buffer) const
+        { pool->release(buffer, size_class); }
+    };
+
+    /** Allocator for the control blocks of buffer_ptr_t.
+    * Control blocks are recycled as well, so acquiring a pooled buffer does
+    * not allocate any memory at all.
+    * The allocator holds a reference to the pool, because the control block
+    * is deallocated after the deleter was destroyed.
+    */
+    template <typename T>
+    struct NodeAllocator
+    {
+        typedef T value_type;
+
+        std::shared_ptr<BufferPool> pool;
+
+        NodeAllocator(std::shared_ptr<BufferPool> pool_) : pool(pool_) {}
+
+        template <typename U>
+        NodeAllocator(const NodeAllocator<U>& other) : pool(other.pool) {}
+
+        T* allocate(std::size_t n)
+        {
+            static_assert(sizeof(T) <= node_size,
+                "Control block does not fit into a pool node");
+            return static_cast<T*>(pool->allocateNode(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, std::size_t n)
+        { pool->deallocateNode(p, n * sizeof(T)); }
+
+        template <typename U>
+        bool operator== (const NodeAllocator<U>& other) const
+        { return pool == other.pool; }
+
+        template <typename U>
+        bool operator!= (const NodeAllocator<U>& other) const
+        { return pool != other.pool; }
+    };
+
+    /** Size of a node for a control block */
+    static constexpr std::size_t node_size = 128;
+
+    /** Return the size class for a buffer size, class_count if too big */
+    static unsigned sizeClass(std::size_t size);
+
+    /** Put a buffer back into its size class, or delete it. */
+    void release(byte_traits::byte_sequence* buffer, unsigned size_class);
+
+    void* allocateNode(std::size_t size);
+    void deallocateNode(void* node, std::size_t size);
+
+    /** Maximum number of unused buffers per size class */
+    const std::size_t max_free_buffers;
+
+    /** Unused buffers, one list per size class */
+    std::vector<byte_traits::byte_sequence*> free_buffers[class_count];
+
+    /** Unused control block nodes */
+    std::vector<void*> free_nodes;
+
+    std::atomic<unsigned long long> acquired_count;
+    std::atomic<unsigned long long> allocated_count;
+
+    /** Mutex protecting the free lists */
+    boost::mutex pool_mutex;
+
+    // no copy construction allowed
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator= (const BufferPool&) = delete;
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef BUFFERPOOL_HPP_INCLUDED
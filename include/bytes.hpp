@@ -49,6 +49,7 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <type_traits>
 
 /** General namespace for the Nuclear Messaging System project */
 namespace nuke_ms
@@ -241,6 +242,15 @@ inline T to_netbo(T x) { return reversebytes(x); }
 template <typename T>
 inline T to_hostbo(T x) { return reversebytes(x); }
 
+/** Check whether to_netbo() and to_hostbo() leave values of a type unchanged.
+* On a Big Endian system, this is only true for single byte types.
+* @tparam T The type of the integer
+*/
+template <typename T>
+struct netbo_is_identity
+    : public std::integral_constant<bool, sizeof(T) == 1>
+{};
+
 
 #else
 
@@ -276,9 +286,127 @@ inline T to_netbo(T x) { return x; }
 template <typename T>
 inline T to_hostbo(T x) { return x; }
 
+/** Check whether to_netbo() and to_hostbo() leave values of a type unchanged.
+* On a Little Endian system, this is true for all types.
+* @tparam T The type of the integer
+*/
+template <typename T>
+struct netbo_is_identity : public std::true_type
+{};
+
 #endif
 
 
+/// @cond INTERNAL
+namespace detail
+{
+
+// the byte order needs no conversion, copy all bytes at once
+template <typename T, typename ByteSequenceIterator> inline
+ByteSequenceIterator writesequence(
+    ByteSequenceIterator it, const T* values, std::size_t count,
+    std::true_type
+)
+{
+    return std::copy(
+        reinterpret_cast<const byte_traits::byte_t*>(values),
+        reinterpret_cast<const byte_traits::byte_t*>(values + count),
+        it
+    );
+}
+
+// convert every value on its own
+template <typename T, typename ByteSequenceIterator> inline
+ByteSequenceIterator writesequence(
+    ByteSequenceIterator it, const T* values, std::size_t count,
+    std::false_type
+)
+{
+    for (const T* end = values + count; values != end; ++values)
+        it = writebytes(it, to_netbo(*values));
+
+    return it;
+}
+
+// the byte order needs no conversion, copy all bytes at once
+template <typename T, typename ByteSequenceIterator> inline
+ByteSequenceIterator readsequence(
+    T* values, std::size_t count, ByteSequenceIterator it,
+    std::true_type
+)
+{
+    std::copy(
+        it,
+        it + count * sizeof(T),
+        reinterpret_cast<byte_traits::byte_t*>(values)
+    );
+
+    return it + count * sizeof(T);
+}
+
+// convert every value on its own
+template <typename T, typename ByteSequenceIterator> inline
+ByteSequenceIterator readsequence(
+    T* values, std::size_t count, ByteSequenceIterator it,
+    std::false_type
+)
+{
+    for (T* end = values + count; values != end; ++values)
+    {
+        it = readbytes(values, it);
+        *values = to_hostbo(*values);
+    }
+
+    return it;
+}
+
+} // namespace detail
+/// @endcond
+
+
+/** Write an array of integers in network byte order into a byte sequence.
+* If the byte order needs no conversion, all bytes are copied at once.
+*
+* @tparam T The type of the integers.
+* @tparam ByteSequenceIterator Type of the iterator to the byte sequence. Must
+* meet the requirement of OutputIterator.
+*
+* @param it Iterator to the byte sequence
+* @param values Pointer to the first integer
+* @param count Number of integers
+* @return Returns it + count*sizeof(T)
+*/
+template <typename T, typename ByteSequenceIterator> inline
+ByteSequenceIterator writesequence(
+    ByteSequenceIterator it, const T* values, std::size_t count
+)
+{
+    return detail::writesequence(
+        it, values, count, typename netbo_is_identity<T>::type());
+}
+
+/** Read an array of integers in network byte order from a byte sequence.
+* If the byte order needs no conversion, all bytes are copied at once.
+*
+* @tparam T The type of the integers.
+* @tparam ByteSequenceIterator Iterator to the byte sequence. Must meet
+* RandomAccessIterator requirement.
+*
+* @param values Pointer to the first integer that will be written to
+* @param count Number of integers
+* @param it Iterator to the sequence that contains the bytes of the integers
+* @return Returns it + count*sizeof(T)
+*/
+template <typename T, typename ByteSequenceIterator> inline
+ByteSequenceIterator readsequence(
+    T* values, std::size_t count, ByteSequenceIterator it
+)
+{
+    return detail::readsequence(
+        values, count, it, typename netbo_is_identity<T>::type());
+}
+
+
 /**@}*/ // addtogroup common
 
 
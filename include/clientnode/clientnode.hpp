@@ -138,30 +138,58 @@ public:
     void connectTo(const ServerLocation& where);
 
 
+    /** Set the user identifier of this client.
+     *
+     * The identifier is sent as sender of all following messages. It is
+     * announced to the server right away if connected, otherwise when the
+     * connection is established. From then on the server delivers messages
+     * addressed to this identifier to this client.
+     * Messages that are sent at the same time may carry either identifier.
+     *
+     * @param id The user identifier
+     */
+    void setUserId(const UniqueUserID& id);
+
+    /** Write sent messages in batches.
+     *
+     * Messages are held back until the queued messages reach
+     * options.max_bytes or the oldest one has waited for options.max_delay,
+     * then they are written at once. Messages that are queued while a batch
+     * is written go into the next batch. There is one send report per batch,
+     * listing all messages of the batch.
+     * Batching is disabled by default, set options.max_bytes to zero to
+     * disable it again.
+     *
+     * @param options The batching options
+     */
+    void setBatching(const BatchOptions& options);
+
     /** Send message to connected remote site.
      *
      * This will send the user message to the recipient specified.
      * If recipient is set to UniqueUserID::user_id_none, the
-     * message will be sent to all clients connected to the server.
+     * message will be sent to all other clients connected to the server.
+     *
+     * The message is serialized right away into a buffer from the
+     * BufferPool, the string is not referenced after the call.
      *
      * @param msg The message you want to send
      * @param recipient Recipient of the message
      * @return the message identifier of the sent message
      */
     NearUserMessage::msg_id_t sendUserMessage(
-        byte_traits::msg_string&& msg,
+        const byte_traits::msg_string& msg,
         const UniqueUserID& recipient = UniqueUserID()
     );
 
     NearUserMessage::msg_id_t sendUserMessage(
-        const byte_traits::msg_string& msg,
+        byte_traits::msg_string&& msg,
         const UniqueUserID& recipient = UniqueUserID()
     )
     {
-        // create copy and move it into the sendUserMessage function
-        /* FIXME use initializer list syntax, seems like a compiler bug? */
-        // return sendUserMessage(std::move(byte_traits::msg_string{msg}), recipient);
-        return sendUserMessage(std::move(byte_traits::msg_string(msg)), recipient);
+        // the message is serialized, so there is nothing to take over
+        return sendUserMessage(
+            static_cast<const byte_traits::msg_string&>(msg), recipient);
     }
 
 
@@ -180,7 +208,11 @@ private:
         // for now this is a simple increment.
         // Maybe in the future there will be a need for more sophisticated
         // identifier algorithms.
-        return ++last_msg_id;
+        // The identifier 0 is used for packets of the client node itself.
+        if (!++last_msg_id)
+            ++last_msg_id;
+
+        return last_msg_id;
     }
 
     /** The Streams used for message output */
@@ -190,7 +222,7 @@ private:
     ClientnodeMachine statemachine;
 
     /** A mutex to gain access to the state machine */
-    boost::mutex machine_mutex;
+    boost::recursive_mutex machine_mutex;
 
     /** The function object that will be called, if an event occurs.*/
     ClientNodeSignals signals;
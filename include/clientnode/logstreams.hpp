@@ -18,9 +18,14 @@
 */
 
 /** @file clientnode/logstreams.hpp
-* @brief Logging output streams used ClientNode module.
+* @brief Logging facilities used ClientNode module.
 * @ingroup clientnode
 *
+* The state machine of the ClientNode logs while it holds its mutex. So
+* messages are not written right away: the arguments of a message are stored
+* in a queue, and a background thread formats them and hands them to a
+* LogSink. Logging a message never waits for a stream.
+*
 * @author Alexander Korsunsky
 */
 
@@ -28,6 +33,10 @@
 #define LOGSTREAMS_HPP
 
 #include <iostream>
+#include <string>
+#include <memory>
+#include <functional>
+#include <type_traits>
 
 namespace nuke_ms
 {
@@ -41,22 +50,182 @@ namespace nuke_ms
 namespace clientnode
 {
 
-/** Wrapper class for logging streams. */
-struct LoggingStreams
+/** Severity of a log message */
+enum class LogSeverity
 {
-    /** Stream info messages will be written to */
-    std::ostream& infostream;
+    debug,
+    info,
+    warning,
+    error
+};
 
-    /** Stream warning messages will be written to */
-    std::ostream& warnstream;
+/** Destination of log messages.
+* Derive from this class to send the log messages of the ClientNode somewhere
+* else. The member functions are only called from the background thread of
+* the log, one at a time.
+*/
+class LogSink
+{
+public:
+    virtual ~LogSink() {}
 
-    /** Stream error messages will be written to */
-    std::ostream& errorstream;
+    /** Write a formatted message.
+    * @param severity Severity of the message
+    * @param message The message, without a trailing newline
+    */
+    virtual void write(LogSeverity severity, const std::string& message) = 0;
+
+    /** Called after a batch of messages was written. */
+    virtual void flush() {}
+};
 
-    /** Default constructor, initialize to std::clog and std::cerr */
-    LoggingStreams() :
-        infostream(std::clog), warnstream(std::cerr), errorstream(std::cerr)
+/** Sink that writes messages to output streams */
+class StreamLogSink : public LogSink
+{
+public:
+    /** Constructor.
+    * @param infostream_ Stream for debug and info messages
+    * @param warnstream_ Stream for warnings
+    * @param errorstream_ Stream for errors
+    */
+    StreamLogSink(
+        std::ostream& infostream_ = std::clog,
+        std::ostream& warnstream_ = std::cerr,
+        std::ostream& errorstream_ = std::cerr
+    )
+        : infostream(infostream_), warnstream(warnstream_),
+        errorstream(errorstream_)
     {}
+
+    void write(LogSeverity severity, const std::string& message) override;
+
+    void flush() override;
+
+private:
+    std::ostream& infostream;
+    std::ostream& warnstream;
+    std::ostream& errorstream;
+};
+
+
+class AsyncLogger;
+
+namespace detail
+{
+
+/** Type a log argument is stored as until it is formatted.
+* Character pointers are copied into a string, because the characters might
+* not live until the message is formatted. Character arrays are expected to
+* be string literals and are stored as pointers.
+*/
+template <typename T>
+struct StoredLogArgument
+{
+    typedef typename std::decay<T>::type decayed_type;
+
+    typedef typename std::conditional<
+        !std::is_array<typename std::remove_reference<T>::type>::value
+        && (std::is_same<decayed_type, const char*>::value
+            || std::is_same<decayed_type, char*>::value),
+        std::string, decayed_type
+    >::type type;
+};
+
+/** Write all arguments of a message to a stream, in order */
+template <typename... T>
+void writeLogArguments(std::ostream& os, const T&... values)
+{
+    int expand[] = {0, ((os<<values), 0)...};
+    (void) expand;
+}
+
+} // namespace detail
+
+
+/** Log of the ClientNode.
+*
+* Messages are given as a list of arguments that are written to a stream one
+* after the other, e.g. info("Connected to ", host, ':', port). The arguments
+* are copied and only formatted by the background thread, so a message costs
+* about as much as copying its arguments. Messages below the minimum severity
+* are discarded right away, without copying anything.
+*
+* Messages are kept in a bounded queue. If the background thread falls behind
+* and the queue is full, messages are dropped, the number of dropped messages
+* is reported later.
+*
+* Copies of an object share the same queue and background thread. The thread
+* is stopped when the last copy is destroyed, after all queued messages were
+* written.
+*/
+class LoggingStreams
+{
+public:
+    /** Type of a function that writes a message to a stream */
+    typedef std::function<void(std::ostream&)> formatter_t;
+
+    /** Constructor, log to std::clog and std::cerr.
+    * @param min_severity_ Messages below this severity are discarded
+    */
+    LoggingStreams(LogSeverity min_severity_ = LogSeverity::info);
+
+    /** Constructor, log to a custom sink.
+    * @param sink The sink the messages are written to
+    * @param min_severity_ Messages below this severity are discarded
+    */
+    LoggingStreams(
+        std::shared_ptr<LogSink> sink,
+        LogSeverity min_severity_ = LogSeverity::info
+    );
+
+    /** Check if messages of a severity would be written. */
+    bool enabled(LogSeverity severity) const
+    { return severity >= min_severity; }
+
+    /** Log a message.
+    * @param severity Severity of the message
+    * @param args Arguments of the message, each is written to a std::ostream
+    */
+    template <typename... Args>
+    void log(LogSeverity severity, Args&&... args)
+    {
+        if (enabled(severity))
+            submit(
+                severity,
+                std::bind(
+                    &detail::writeLogArguments<
+                        typename detail::StoredLogArgument<Args>::type...
+                    >,
+                    std::placeholders::_1,
+                    typename detail::StoredLogArgument<Args>::type(
+                        std::forward<Args>(args))...
+                )
+            );
+    }
+
+    template <typename... Args>
+    void debug(Args&&... args)
+    { log(LogSeverity::debug, std::forward<Args>(args)...); }
+
+    template <typename... Args>
+    void info(Args&&... args)
+    { log(LogSeverity::info, std::forward<Args>(args)...); }
+
+    template <typename... Args>
+    void warning(Args&&... args)
+    { log(LogSeverity::warning, std::forward<Args>(args)...); }
+
+    template <typename... Args>
+    void error(Args&&... args)
+    { log(LogSeverity::error, std::forward<Args>(args)...); }
+
+private:
+    LogSeverity min_severity;
+
+    std::shared_ptr<AsyncLogger> logger;
+
+    /** Put a message into the queue */
+    void submit(LogSeverity severity, formatter_t&& formatter);
 };
 
 } // namespace clientnode
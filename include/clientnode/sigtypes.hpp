@@ -33,6 +33,7 @@
 
 #include <boost/signals2/signal.hpp>
 #include <memory>
+#include <vector>
 
 #include "bytes.hpp"
 #include "neartypes.hpp"
@@ -91,6 +92,12 @@ struct ConnectionStatusReport
 struct SendReport
 {
     NearUserMessage::msg_id_t message_id; /**< ID of the message in question */
+
+    /** IDs of all messages in question, if the report is about a batch of
+    * messages, see ClientNode::setBatching(). message_id is the last of
+    * them. Empty if the report is about a single message.
+    */
+    std::vector<NearUserMessage::msg_id_t> message_ids;
     bool send_state; /**< Was it sent or not */
 
 	/** Enum for the reasons for failure while sending a message */
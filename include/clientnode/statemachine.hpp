@@ -27,9 +27,14 @@
 #ifndef STATEMACHINE_HPP
 #define STATEMACHINE_HPP
 
+#include <atomic>
+#include <chrono>
+#include <vector>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/condition_variable.hpp>
+#include <boost/thread/recursive_mutex.hpp>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/statechart/state_machine.hpp>
 #include <boost/statechart/state.hpp>
 #include <boost/statechart/custom_reaction.hpp>
@@ -37,6 +42,9 @@
 #include <boost/ref.hpp>
 
 #include "msglayer.hpp"
+#include "bufferpool.hpp"
+#include "segmentationreader.hpp"
+#include "fragmentassembler.hpp"
 #include "clientnode/logstreams.hpp"
 #include "clientnode/sigtypes.hpp"
 #include "refcounter.hpp"
@@ -117,44 +125,67 @@ struct EvtDisconnected :
     {}
 };
 
-/** Event representing a sent message
+/** Event representing a message that shall be sent.
+* The message is already serialized into a pooled buffer, only the
+* segmentation headers are missing.
 * @ingroup proto_machine
 */
-template <typename MessageType>
-struct EvtSendMsg : public boost::statechart::event<EvtSendMsg<MessageType>>
+struct EvtSendPacket : public boost::statechart::event<EvtSendPacket>
 {
-    /** The data of the message */
-    std::shared_ptr<MessageType> _data;
+    /** Buffer holding the serialized message at the end of its first
+    * packet_size bytes. The bytes in front of it are left for the headers,
+    * see SegmentationLayerBase::segmentInPlace().
+    */
+    BufferPool::buffer_ptr_t buffer;
 
-    /** Constructor.
-    * @param _data The text of the message.
+    /** Size of the packets, including the headers */
+    std::size_t packet_size;
+
+    /** Size of the serialized message */
+    std::size_t payload_size;
+
+    /** ID of the message, used in the send report. Packets with the ID 0
+    * are sent by the client node itself and are not reported.
     */
-    EvtSendMsg(MessageType&& data)
-        : _data(std::make_shared<MessageType>(std::move(data)))
+    NearUserMessage::msg_id_t msg_id;
+
+    EvtSendPacket(
+        BufferPool::buffer_ptr_t&& buffer_,
+        std::size_t packet_size_,
+        std::size_t payload_size_,
+        NearUserMessage::msg_id_t msg_id_
+    )
+        : buffer(std::move(buffer_)), packet_size(packet_size_),
+        payload_size(payload_size_), msg_id(msg_id_)
     {}
-
-    EvtSendMsg(const EvtSendMsg&) = default;
 };
 
-/** Event representing a received message
+/** Options for writing sent messages in batches.
 * @ingroup proto_machine
-* @ingroup netdata
+*
+* Writing every message on its own costs a system call and usually a TCP
+* segment per message. With batching, messages are held back until enough of
+* them are queued or the oldest one has waited long enough, and then written
+* at once. A single send report covers the whole batch.
 */
-template <typename UpperLayer>
-struct EvtRcvdMessage :
-    public boost::statechart::event<EvtRcvdMessage<UpperLayer>>
+struct BatchOptions
 {
-    /** The data of the message. */
-    std::shared_ptr<SegmentationLayer<UpperLayer>> _data;
-
-    /** Constructor.
-    * @param _data The data of the message.
+    /** Number of bytes that are written at once. Messages are held back
+    * until the queued messages reach this size. Zero disables batching,
+    * messages are written as soon as possible and every message gets its own
+    * send report.
     */
-    EvtRcvdMessage(SegmentationLayer<UpperLayer>&& data)
-        :_data(std::make_shared<SegmentationLayer<UpperLayer>>(std::move(data)))
-    {}
+    std::size_t max_bytes;
+
+    /** Maximum time a message is held back */
+    std::chrono::microseconds max_delay;
 
-    EvtRcvdMessage(const EvtRcvdMessage<UpperLayer>&) = default;
+    explicit BatchOptions(
+        std::size_t max_bytes_ = 0,
+        std::chrono::microseconds max_delay_ = std::chrono::microseconds(0)
+    )
+        : max_bytes(max_bytes_), max_delay(max_delay_)
+    {}
 };
 
 
@@ -191,9 +222,15 @@ class ClientnodeMachine :
     */
     boost::condition_variable returned_condition;
 
+    /** Mutex for waiting on returned_condition */
+    boost::mutex returned_mutex;
+
     /** Callback that will be called when all handlers have returned */
     void on_returned()
-    { returned_condition.notify_all(); }
+    {
+        boost::mutex::scoped_lock lk(returned_mutex);
+        returned_condition.notify_all();
+    }
 
 
 public:
@@ -211,14 +248,90 @@ public:
     /** Resolver used for any resolve operations */
     boost::asio::ip::tcp::resolver resolver;
 
-    /** A reference to the mutex that is needed to access this machine */
-    boost::mutex& machine_mutex;
+    /** A reference to the mutex that is needed to access this machine.
+    * It is recursive, so the application may call ClientNode functions from
+    * the signals that are issued while it is held.
+    */
+    boost::recursive_mutex& machine_mutex;
+
+    /** True while the machine is in StateConnected.
+    * While it is set, messages are sent and received directly, without
+    * dispatching events to the state machine. It is cleared before the queued
+    * packets are reported, so a packet queued while it is set under
+    * batch_mutex is always written or reported.
+    */
+    std::atomic<bool> connected;
+
+    /** User identifier that is sent as sender of the messages. The server
+    * is told about it whenever it changes and when the connection is
+    * established.
+    */
+    std::atomic<decltype(UniqueUserID::id)> user_id;
+
+    /** A packet that is queued or being written */
+    struct BatchedPacket
+    {
+        BufferPool::buffer_ptr_t buffer;
+        std::size_t size;
+        NearUserMessage::msg_id_t msg_id;
+    };
+
+    /** How messages are batched. Protected by batch_mutex. */
+    BatchOptions batch_options;
+
+    /** Packets waiting to be written. Protected by batch_mutex. */
+    std::vector<BatchedPacket> batch_queue;
+
+    /** Number of bytes in batch_queue. Protected by batch_mutex. */
+    std::size_t batch_queued_bytes;
+
+    /** Packets written at once, together with their buffers */
+    struct BatchWrite
+    {
+        std::vector<BatchedPacket> packets;
+        std::vector<boost::asio::const_buffer> buffers;
+
+        /** True if every packet gets its own send report, false if one
+        * report covers the batch.
+        */
+        bool report_each;
+    };
+
+    /** The batch that is being written, or null. Its handler only reports
+    * the batch if it is still set, so every batch is reported once.
+    * Protected by batch_mutex.
+    */
+    std::shared_ptr<BatchWrite> batch_writing;
+
+    /** True while batch_timer is waiting. Protected by batch_mutex. */
+    bool batch_timer_armed;
+
+    /** Incremented whenever batch_timer is armed, so a handler of an earlier
+    * wait can tell that it is outdated. Protected by batch_mutex.
+    */
+    unsigned batch_timer_generation;
+
+    /** Timer that writes held back packets after BatchOptions::max_delay */
+    boost::asio::steady_timer batch_timer;
+
+    /** True while a call of StateConnected::writeQueued is posted to the
+    * I/O thread. Protected by batch_mutex.
+    */
+    bool write_scheduled;
+
+    /** Incremented for every connection, so handlers of an earlier connection
+    * can tell that they are outdated. Protected by batch_mutex.
+    */
+    unsigned connection_id;
+
+    /** Mutex protecting the write queue and the batch state */
+    boost::mutex batch_mutex;
 
 
     /** Constructor.
     */
     ClientnodeMachine(ClientNodeSignals&  _signals,
-		LoggingStreams logstreams_, boost::mutex& _machine_mutex);
+		LoggingStreams logstreams_, boost::recursive_mutex& _machine_mutex);
 
 
     /** Destructor. Stops all I/O operations and threads as cleanly as possible.
@@ -239,6 +352,32 @@ public:
     */
     void stopIOOperations();
 
+    /** Run a function in the I/O thread.
+    * This function is thread safe.
+    */
+    template <typename Function>
+    void post(Function&& function)
+    { io_service->post(std::forward<Function>(function)); }
+
+    /** Return a stream identifier for the fragments of the next message.
+    * This function is thread safe.
+    */
+    SegmentationLayerBase::stream_id_t nextStreamId()
+    {
+        SegmentationLayerBase::stream_id_t stream_id;
+
+        // zero means "no stream"
+        do
+            stream_id = ++next_stream_id;
+        while (!stream_id);
+
+        return stream_id;
+    }
+
+private:
+    /** The stream identifier of the last sent message */
+    std::atomic<SegmentationLayerBase::stream_id_t> next_stream_id;
+
 };
 
 
@@ -248,7 +387,7 @@ public:
 *
 * Reacting to:
 * EvtConnectRequest
-* EvtSendMsg
+* EvtSendPacket
 */
 struct StateWaiting :
     public boost::statechart::state<StateWaiting, ClientnodeMachine>
@@ -257,14 +396,14 @@ struct StateWaiting :
     /** State reactions. */
     typedef boost::mpl::list<
         boost::statechart::custom_reaction<EvtConnectRequest>,
-        boost::statechart::custom_reaction<EvtSendMsg<NearUserMessage>>
+        boost::statechart::custom_reaction<EvtSendPacket>
     > reactions;
 
     /** Constructor. To be used only by Boost.Statechart classes. */
     StateWaiting(my_context ctx);
 
     boost::statechart::result react(const EvtConnectRequest&);
-    boost::statechart::result react(const EvtSendMsg<NearUserMessage>&);
+    boost::statechart::result react(const EvtSendPacket& evt);
 
 };
 
@@ -282,7 +421,7 @@ struct StateNegotiating :
     typedef boost::mpl::list<
         boost::statechart::custom_reaction<EvtConnectReport>,
         boost::statechart::custom_reaction<EvtDisconnectRequest>,
-        boost::statechart::custom_reaction<EvtSendMsg<NearUserMessage>>, // FIXME Use a template version of this function!
+        boost::statechart::custom_reaction<EvtSendPacket>,
         boost::statechart::custom_reaction<EvtConnectRequest>
     > reactions;
 
@@ -306,7 +445,7 @@ struct StateNegotiating :
 
     boost::statechart::result react(const EvtConnectReport& evt);
     boost::statechart::result react(const EvtDisconnectRequest&);
-    boost::statechart::result react(const EvtSendMsg<NearUserMessage>&);
+    boost::statechart::result react(const EvtSendPacket& evt);
     boost::statechart::result react(const EvtConnectRequest& evt);
 };
 
@@ -317,40 +456,98 @@ struct StateConnected :
     /** State reactions. */
     typedef boost::mpl::list<
         boost::statechart::custom_reaction<EvtDisconnectRequest>,
-        boost::statechart::custom_reaction<EvtSendMsg<NearUserMessage>>,
+        boost::statechart::custom_reaction<EvtSendPacket>,
         boost::statechart::custom_reaction<EvtDisconnected>,
-        boost::statechart::custom_reaction<EvtRcvdMessage<SerializedData>>,
         boost::statechart::custom_reaction<EvtConnectRequest>
     > reactions;
 
     /** Constructor. To be used only by Boost.Statechart classes. */
     StateConnected(my_context ctx);
 
+    /** Destructor, reports packets that were held back or are still being
+    * written as not sent.
+    */
+    ~StateConnected();
+
     boost::statechart::result react(const EvtDisconnectRequest&);
-    boost::statechart::result react(const EvtSendMsg<NearUserMessage>&);
+    boost::statechart::result react(const EvtSendPacket& evt);
     boost::statechart::result react(const EvtDisconnected& evt);
-    boost::statechart::result react(const EvtRcvdMessage<SerializedData>& evt);
+
+    /** Queue a packet for writing.
+    * This is called for every sent message while connected, without
+    * holding machine_mutex. The socket is only used by the I/O thread, the
+    * packet is written from there. If the connection was closed meanwhile,
+    * the packet is reported as not sent.
+    */
+    static void sendPacket(ClientnodeMachine& cm, const EvtSendPacket& packet);
+
+    /** Tell the server which user this client is, so it delivers the
+    * messages for the user here before this client has sent one.
+    * This sends a user message without recipient and text, which the server
+    * does not relay. Does nothing if no user identifier is set.
+    */
+    static void announceUser(ClientnodeMachine& cm);
+
+    /** Make sure that the I/O thread looks at the write queue.
+    * Only call this with batch_mutex locked.
+    */
+    static void scheduleWrite(ClientnodeMachine& cm);
+
+    /** Write the queued packets, or arm the batch timer if there are not
+    * enough of them. Runs in the I/O thread.
+    * @param connection_id The connection the call was scheduled for
+    */
+    static void writeQueued(
+        ClientnodeMachine::CountedReference cm,
+        unsigned connection_id
+    );
+
+    /** Hand a received message to the application.
+    * This is called for every received message while connected, without
+    * holding machine_mutex.
+    */
+    static void deliverMessage(ClientnodeMachine& cm, SerializedData&& data);
     boost::statechart::result react(const EvtConnectRequest& evt);
 
-    static void writeHandler(
+    /** Write all queued packets at once.
+    * Only call this from the I/O thread with batch_mutex locked, while no
+    * batch is being written.
+    */
+    static void startBatchWrite(ClientnodeMachine::CountedReference cm);
+
+    /** Handler for completed writes, sends one report for the batch or one
+    * for every packet.
+    */
+    static void batchWriteHandler(
         const boost::system::error_code& error,
-        std::size_t bytes_transferred,
+        std::size_t /* bytes_transferred */,
         ClientnodeMachine::CountedReference cm,
-        std::shared_ptr<byte_traits::byte_sequence> data
+        std::shared_ptr<ClientnodeMachine::BatchWrite> batch
     );
 
-    static void receiveSegmentationHeaderHandler(
+    /** Handler of the batch timer, writes the held back packets
+    * @param generation The value of batch_timer_generation when the timer was
+    * armed.
+    */
+    static void batchTimerHandler(
         const boost::system::error_code& error,
-        std::size_t bytes_transferred,
         ClientnodeMachine::CountedReference cm,
-        byte_traits::byte_t rcvbuf[SegmentationLayerBase::header_length]
+        unsigned generation
+    );
+
+    /** Start an asynchronous read of the next packets. */
+    static void startReceive(
+        ClientnodeMachine::CountedReference cm,
+        std::shared_ptr<SegmentationStreamReader> reader,
+        std::shared_ptr<FragmentAssembler> assembler
     );
 
-    static void receiveSegmentationBodyHandler(
+    static void receiveHandler(
         const boost::system::error_code& error,
         std::size_t bytes_transferred,
         ClientnodeMachine::CountedReference cm,
-        std::shared_ptr<byte_traits::byte_sequence> rcvbuf
+        std::shared_ptr<SegmentationStreamReader> reader,
+        std::shared_ptr<FragmentAssembler> assembler
     );
 
 };
@@ -0,0 +1,114 @@
+// fragmentassembler.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file fragmentassembler.hpp
+* @ingroup common
+* @brief Putting fragmented messages back together
+*
+* Messages that are larger than the maximum packet size are sent as a stream
+* of fragments, see SegmentationLayerBase::segmentInPlace(). Fragments of
+* different messages may arrive interleaved with each other and with
+* complete packets, so a large message does not hold up the small ones sent
+* after it.
+*/
+
+#ifndef FRAGMENTASSEMBLER_HPP_INCLUDED
+#define FRAGMENTASSEMBLER_HPP_INCLUDED
+
+#include <vector>
+
+#include "msglayer.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Collects fragments of messages until a message is complete.
+*
+* Packets that are not fragmented are passed through without being copied.
+*
+* This class is not thread safe.
+*/
+class FragmentAssembler
+{
+public:
+    /** Maximum size of a message, unless configured otherwise */
+    static constexpr std::size_t default_max_message_size = 16*1024*1024;
+
+    /** Maximum number of messages that are assembled at the same time,
+    * unless configured otherwise */
+    static constexpr std::size_t default_max_streams = 16;
+
+    /** Constructor.
+    * @param max_message_size Maximum size of an assembled message.
+    * @param max_streams Maximum number of messages that are assembled at the
+    * same time. If a new message starts when the limit is reached, the
+    * message that was not continued for the longest time is discarded.
+    */
+    explicit FragmentAssembler(
+        std::size_t max_message_size = default_max_message_size,
+        std::size_t max_streams = default_max_streams
+    );
+
+    /** Add a received packet.
+    *
+    * @param packet A packet including its segmentation layer header, as
+    * returned by SegmentationStreamReader::nextPacket().
+    * @param message Is set to the complete message, without segmentation
+    * layer header. Unchanged if no message was completed.
+    * @returns true if a message was completed, false if the packet was a
+    * fragment of a message that is not complete yet, or was discarded.
+    * @throws InvalidHeaderError if the header of the packet is invalid.
+    * @throws OversizedPacketError if the message gets too big.
+    */
+    bool addPacket(const SerializedData& packet, SerializedData& message);
+
+private:
+    /** A message that is being assembled */
+    struct Stream
+    {
+        SegmentationLayerBase::stream_id_t stream_id;
+        std::shared_ptr<byte_traits::byte_sequence> data;
+        unsigned long last_used;
+    };
+
+    const std::size_t _max_message_size;
+    const std::size_t _max_streams;
+
+    /** Messages that are being assembled. There are few, so a plain list is
+    * good enough. */
+    std::vector<Stream> _streams;
+
+    /** Number of fragments added, used to find the least recently used
+    * stream */
+    unsigned long _fragment_count;
+
+    /** Return the stream with the given identifier, or _streams.end() */
+    std::vector<Stream>::iterator findStream(
+        SegmentationLayerBase::stream_id_t stream_id);
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef FRAGMENTASSEMBLER_HPP_INCLUDED
@@ -0,0 +1,226 @@
+// gatherbuffers.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file gatherbuffers.hpp
+* @ingroup common
+* @brief Serializing messages into a sequence of buffers
+*
+* fillSerialized() writes a message into one contiguous buffer, so every
+* payload is copied before the message can be sent. Most of a message is its
+* payload though, and the payload is already stored somewhere: in the string
+* of a StringwrapLayer or in the memory block of a SerializedData object.
+* fillBuffers() only generates the headers and references the payloads, the
+* resulting buffer sequence can be passed to a gathering write.
+*/
+
+#ifndef GATHERBUFFERS_HPP_INCLUDED
+#define GATHERBUFFERS_HPP_INCLUDED
+
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <boost/asio/buffer.hpp>
+
+#include "bytes.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Buffer sequence of a serialized message.
+*
+* The headers of the message layers are stored in this object, payloads are
+* only referenced. The buffers are valid as long as this object and the
+* message it was filled from are alive and unchanged.
+*
+* Headers that are appended one after the other are merged into one buffer,
+* so a message with several layers usually takes two buffers: the headers and
+* the payload.
+*
+* This class is not thread safe.
+*/
+class GatherBuffers
+{
+public:
+    /** Space for the headers of all layers, in bytes */
+    static constexpr std::size_t header_capacity = 64;
+
+    /** Maximum number of buffers */
+    static constexpr std::size_t max_buffers = 8;
+
+    /** Buffer sequence type that can be passed to async_write.
+    * It references the buffers of the GatherBuffers object it was returned
+    * from.
+    */
+    struct const_buffers_type
+    {
+        typedef boost::asio::const_buffer value_type;
+        typedef const boost::asio::const_buffer* const_iterator;
+
+        const_iterator begin() const
+        { return _begin; }
+
+        const_iterator end() const
+        { return _end; }
+
+        const_iterator _begin;
+        const_iterator _end;
+    };
+
+    GatherBuffers()
+        : _header_length(0), _buffer_count(0), _size(0),
+        _last_is_header(false)
+    {}
+
+    /** Reserve space for a header.
+    * @param length The length of the header.
+    * @returns A pointer to length bytes that the header shall be written to.
+    * @throws std::length_error if the header space or the buffers are
+    * exhausted.
+    */
+    byte_traits::byte_t* appendHeader(std::size_t length)
+    {
+        if (length > header_capacity - _header_length)
+            throw std::length_error("Gather buffer header space exhausted");
+
+        byte_traits::byte_t* header = _headers + _header_length;
+
+        // continue the previous header buffer if there is one
+        if (_last_is_header)
+        {
+            boost::asio::const_buffer& last = _buffers[_buffer_count - 1];
+            last = boost::asio::const_buffer(last.data(), last.size() + length);
+        }
+        else
+            pushBuffer(boost::asio::buffer(header, length));
+
+        _header_length += length;
+        _size += length;
+        _last_is_header = true;
+
+        return header;
+    }
+
+    /** Append a reference to a payload.
+    * The payload is not copied, it must stay valid as long as the buffers
+    * are used. Empty payloads are ignored.
+    * @throws std::length_error if the buffers are exhausted.
+    */
+    void appendPayload(const byte_traits::byte_t* data, std::size_t length)
+    {
+        if (!length)
+            return;
+
+        pushBuffer(boost::asio::buffer(data, length));
+
+        _size += length;
+        _last_is_header = false;
+    }
+
+    /** Return the buffer sequence. */
+    const_buffers_type buffers() const
+    { return const_buffers_type{_buffers, _buffers + _buffer_count}; }
+
+    /** Return the number of buffers. */
+    std::size_t count() const
+    { return _buffer_count; }
+
+    /** Return the total number of bytes in all buffers. */
+    std::size_t size() const
+    { return _size; }
+
+    /** Remove all buffers. */
+    void clear()
+    {
+        _header_length = _buffer_count = _size = 0;
+        _last_is_header = false;
+    }
+
+private:
+    byte_traits::byte_t _headers[header_capacity];
+    std::size_t _header_length;
+
+    boost::asio::const_buffer _buffers[max_buffers];
+    std::size_t _buffer_count;
+
+    std::size_t _size;
+
+    /** True if the last buffer is a header, so the next header can be merged
+    * into it. */
+    bool _last_is_header;
+
+    void pushBuffer(boost::asio::const_buffer buffer)
+    {
+        if (_buffer_count == max_buffers)
+            throw std::length_error("Too many gather buffers");
+
+        _buffers[_buffer_count++] = buffer;
+    }
+
+    // the buffers point into this object, it must not be copied
+    GatherBuffers(const GatherBuffers&) = delete;
+    GatherBuffers& operator= (const GatherBuffers&) = delete;
+};
+
+
+namespace detail
+{
+
+/** A message together with its buffers, see gatherMessage() */
+template <typename Message>
+struct GatheredMessage
+{
+    Message message;
+    GatherBuffers buffers;
+
+    template <typename M>
+    explicit GatheredMessage(M&& msg)
+        : message(std::forward<M>(msg))
+    { message.fillBuffers(buffers); }
+};
+
+} // namespace detail
+
+/** Take over a message and return its buffers.
+* The message is kept alive as long as the returned pointer is referenced, so
+* the buffers can be written asynchronously. Message and buffers share a
+* single allocation.
+*
+* @param msg The message, usually a SegmentationLayer packet. Pass a
+* temporary to avoid copying it.
+*/
+template <typename Message>
+std::shared_ptr<const GatherBuffers> gatherMessage(Message&& msg)
+{
+    auto gathered = std::make_shared<
+        detail::GatheredMessage<typename std::decay<Message>::type>
+    >(std::forward<Message>(msg));
+
+    return std::shared_ptr<const GatherBuffers>(gathered, &gathered->buffers);
+}
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef GATHERBUFFERS_HPP_INCLUDED
@@ -0,0 +1,200 @@
+// headerlayout.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file headerlayout.hpp
+* @ingroup common
+* @brief Compile time description of fixed size packet headers
+*
+* The headers of the message layers consist of a fixed sequence of integer
+* fields. Instead of writing and reading them field by field, a HeaderLayout
+* lists the offset and type of every field. Encoding stores all fields into
+* a local array at constant offsets and copies the whole header at once,
+* decoding does the same in reverse. The offsets are checked at compile time.
+*/
+
+#ifndef HEADERLAYOUT_HPP_INCLUDED
+#define HEADERLAYOUT_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+#include "bytes.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** A field of a packet header.
+* @tparam T Integer type of the field. It is transmitted in network byte
+* order, with a width of sizeof(T) bytes.
+* @tparam Offset Offset of the field from the beginning of the header.
+*/
+template <typename T, std::size_t Offset>
+struct HeaderField
+{
+    typedef T value_type;
+
+    static constexpr std::size_t offset = Offset;
+    static constexpr std::size_t width = sizeof(T);
+    static constexpr std::size_t end = Offset + sizeof(T);
+};
+
+/// @cond INTERNAL
+namespace detail
+{
+
+// check that every field starts where the previous one ended
+template <std::size_t Offset, typename... Fields>
+struct fields_contiguous;
+
+template <std::size_t Offset>
+struct fields_contiguous<Offset>
+{
+    static constexpr bool value = true;
+    static constexpr std::size_t end = Offset;
+};
+
+template <std::size_t Offset, typename Field, typename... Fields>
+struct fields_contiguous<Offset, Field, Fields...>
+{
+    static constexpr bool value = Field::offset == Offset
+        && fields_contiguous<Field::end, Fields...>::value;
+    static constexpr std::size_t end =
+        fields_contiguous<Field::end, Fields...>::end;
+};
+
+// used to evaluate an expression for every element of a parameter pack
+inline void expandPack(std::initializer_list<int>) {}
+
+} // namespace detail
+/// @endcond
+
+/** Layout of a fixed size packet header.
+*
+* Example:
+* @code
+* typedef HeaderLayout<
+*     HeaderField<byte_traits::byte_t, 0>,
+*     HeaderField<byte_traits::uint2b_t, 1>
+* > Layout;
+* static_assert(Layout::length == 3, "Header layout is wrong");
+* @endcode
+*
+* @tparam Fields The HeaderField types of all fields, in the order of their
+* offsets. The fields must follow each other without gaps, starting at
+* offset 0.
+*/
+template <typename... Fields>
+struct HeaderLayout
+{
+    static_assert(detail::fields_contiguous<0, Fields...>::value,
+        "Header fields must follow each other without gaps");
+
+    /** Length of the header in bytes */
+    static constexpr std::size_t length =
+        detail::fields_contiguous<0, Fields...>::end;
+
+    /** Write a header.
+    * @param it Iterator to the buffer the header is written to.
+    * @param values The values of the fields, in host byte order.
+    * @returns it + length
+    */
+    template <typename ByteOutputIterator>
+    static ByteOutputIterator encode(
+        ByteOutputIterator it,
+        typename Fields::value_type... values
+    )
+    {
+        byte_traits::byte_t buffer[length];
+
+        detail::expandPack({ (storeField<Fields>(buffer, values), 0)... });
+
+        return std::copy(buffer, buffer + length, it);
+    }
+
+    /** Read a header.
+    * @param it Iterator to the header. At least length bytes must be
+    * readable.
+    * @param values The variables the fields are stored into, in host byte
+    * order.
+    * @returns it + length
+    */
+    template <typename ByteInputIterator>
+    static ByteInputIterator decode(
+        ByteInputIterator it,
+        typename Fields::value_type&... values
+    )
+    {
+        byte_traits::byte_t buffer[length];
+        std::copy(it, it + length, buffer);
+
+        detail::expandPack({ (loadField<Fields>(buffer, values), 0)... });
+
+        return it + length;
+    }
+
+    /** Read a single field of a header.
+    * @tparam Field One of the fields of this layout.
+    * @param it Iterator to the header. At least length bytes must be
+    * readable.
+    * @returns The value of the field, in host byte order.
+    */
+    template <typename Field, typename ByteInputIterator>
+    static typename Field::value_type decodeField(ByteInputIterator it)
+    {
+        byte_traits::byte_t buffer[length];
+        std::copy(it + Field::offset, it + Field::end, buffer + Field::offset);
+
+        typename Field::value_type value;
+        loadField<Field>(buffer, value);
+
+        return value;
+    }
+
+private:
+    template <typename Field>
+    static void storeField(
+        byte_traits::byte_t* buffer,
+        typename Field::value_type value
+    )
+    {
+        value = to_netbo(value);
+        std::memcpy(buffer + Field::offset, &value, Field::width);
+    }
+
+    template <typename Field>
+    static void loadField(
+        const byte_traits::byte_t* buffer,
+        typename Field::value_type& value
+    )
+    {
+        std::memcpy(&value, buffer + Field::offset, Field::width);
+        value = to_hostbo(value);
+    }
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef HEADERLAYOUT_HPP_INCLUDED
@@ -0,0 +1,153 @@
+// messagearena.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file messagearena.hpp
+* @ingroup common
+* @brief Allocating the objects of a message from a single block of memory
+*
+* Decoding a received message creates several small objects that live
+* exactly as long as the message. Instead of allocating every one of them on
+* the heap, a MessageArena takes one block from the BufferPool and hands out
+* pieces of it. Nothing is freed individually: the block goes back to the
+* pool when the last object allocated from it is gone.
+*/
+
+#ifndef MESSAGEARENA_HPP_INCLUDED
+#define MESSAGEARENA_HPP_INCLUDED
+
+#include <memory>
+#include <utility>
+
+#include "bufferpool.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/// @cond INTERNAL
+namespace detail
+{
+
+/** Allocate memory from an arena block, or from the heap if the block is
+* full. */
+void* arenaAllocate(
+    byte_traits::byte_sequence& block,
+    std::size_t size,
+    std::size_t alignment
+);
+
+/** Release memory allocated by arenaAllocate().
+* Memory inside the block is released together with the block, only heap
+* memory is freed. */
+void arenaDeallocate(byte_traits::byte_sequence& block, void* p);
+
+} // namespace detail
+/// @endcond
+
+/** Allocator handing out memory from the block of a MessageArena.
+*
+* Every copy of the allocator keeps the block alive. std::allocate_shared
+* stores a copy in the control block of the object, so the block is not
+* returned to the pool before the object is destroyed.
+*
+* @tparam T The type of the allocated objects
+*/
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    /** The block of the arena */
+    BufferPool::buffer_ptr_t block;
+
+    explicit ArenaAllocator(BufferPool::buffer_ptr_t block_)
+        : block(std::move(block_))
+    {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : block(other.block) {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(
+            detail::arenaAllocate(*block, n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t)
+    { detail::arenaDeallocate(*block, p); }
+
+    template <typename U>
+    bool operator== (const ArenaAllocator<U>& other) const
+    { return block == other.block; }
+
+    template <typename U>
+    bool operator!= (const ArenaAllocator<U>& other) const
+    { return block != other.block; }
+};
+
+/** Memory for the objects of one message.
+*
+* Usage: create an arena for a message, create the objects of the message
+* with makeShared() and let the arena go out of scope. The objects keep the
+* memory alive.
+*
+* If the block is full, further allocations fall back to the heap.
+*
+* This class is not thread safe, allocate from one thread at a time.
+* Objects may be released from any thread.
+*/
+class MessageArena
+{
+public:
+    /** Size of the block, unless specified otherwise */
+    static constexpr std::size_t default_capacity = 256;
+
+    /** Constructor, takes a block from the BufferPool.
+    * @param capacity Number of bytes that can be allocated from the block,
+    * at least.
+    */
+    explicit MessageArena(std::size_t capacity = default_capacity);
+
+    /** Return an allocator for the arena */
+    template <typename T>
+    ArenaAllocator<T> allocator() const
+    { return ArenaAllocator<T>(_block); }
+
+    /** Create an object in the arena.
+    * The object and its reference count are allocated together.
+    */
+    template <typename T, typename... Args>
+    std::shared_ptr<T> makeShared(Args&&... args) const
+    {
+        return std::allocate_shared<T>(
+            allocator<T>(), std::forward<Args>(args)...);
+    }
+
+private:
+    BufferPool::buffer_ptr_t _block;
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef MESSAGEARENA_HPP_INCLUDED
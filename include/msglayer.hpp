@@ -116,6 +116,8 @@
 #include <type_traits>
 
 #include "bytes.hpp"
+#include "headerlayout.hpp"
+#include "gatherbuffers.hpp"
 
 
 
@@ -163,6 +165,14 @@ struct InvalidHeaderError : public MsgLayerError
     {}
 };
 
+/** Type to denote a packet exceeding the maximum packet size */
+struct OversizedPacketError : public MsgLayerError
+{
+    OversizedPacketError()
+        : MsgLayerError("Oversized packet.")
+    {}
+};
+
 /** Type to denote undersized packet */
 struct UndersizedPacketError : public MsgLayerError
 {
@@ -218,6 +228,20 @@ struct BasicMessageLayer
     template <typename ByteOutputIterator>
     ByteOutputIterator fillSerialized(ByteOutputIterator it) const
     { return DerivedType::fillSerialized(it); }
+
+    /** Append the serialized version of this object to a buffer sequence.
+    * Unlike fillSerialized(), payloads are not copied. Headers are written
+    * into the GatherBuffers object, payloads are appended as references to
+    * the memory they are stored in. The buffers are only valid as long as
+    * this object is alive and unchanged.
+    *
+    * @param buffers The buffer sequence to append to. After the call, it
+    * holds size() more bytes.
+    *
+    * @throws std::length_error if the buffer sequence is exhausted
+    */
+    void fillBuffers(GatherBuffers& buffers) const
+    { static_cast<const DerivedType*>(this)->fillBuffers(buffers); }
 };
 
 
@@ -286,6 +310,14 @@ public:
         return std::copy(_begin_it, _begin_it + _datasize, it);
     }
 
+    // overriding base class version
+    void fillBuffers(GatherBuffers& buffers) const
+    {
+        // reference the maintained data
+        if (_datasize)
+            buffers.appendPayload(&*_begin_it, _datasize);
+    }
+
     /** Get iterator to message data.
     * This function can be used to access the buffer directly, either to copy
     * the contained data into a buffer or to construct a message of an upper
@@ -312,13 +344,96 @@ public:
 struct SegmentationLayerBase
 {
     static constexpr byte_traits::byte_t LAYER_ID = 0x80;
-    static constexpr std::size_t header_length = 4;
+
+    /** Type for the identifier of a fragmented message */
+    typedef byte_traits::uint4b_t stream_id_t;
+
+    /** Flags of a packet, only used in version 1 headers */
+    enum flags_t : byte_traits::byte_t
+    {
+        FLAG_MORE = 0x01,       /**< More fragments of the message follow */
+        FLAG_CONTINUED = 0x02   /**< Not the first fragment of the message */
+    };
+
+    /** Length of a version 0 header, with a 2 byte packet size */
+    static constexpr std::size_t v0_header_length = 4;
+
+    /** Length of a version 1 header, with a 4 byte packet size */
+    static constexpr std::size_t v1_header_length = 12;
+
+    /** Number of bytes needed to find out the length of a header */
+    static constexpr std::size_t min_header_length = v0_header_length;
+
+    /** Maximum length of a header of any version */
+    static constexpr std::size_t max_header_length = v1_header_length;
+
+    /** Maximum size of a packet, unless configured otherwise */
+    static constexpr std::size_t default_max_packetsize = 0x10000;
 
     /** Type representing the header of a packet. */
     struct HeaderType {
-        byte_traits::uint2b_t packetsize /**< Size of the packet */;
+        byte_traits::byte_t version /**< Version of the header, 0 or 1 */;
+        byte_traits::byte_t flags /**< Fragment flags, 0 in version 0 */;
+        byte_traits::uint4b_t packetsize /**< Size of the whole packet */;
+        stream_id_t stream_id /**< Stream of a fragment, 0 otherwise */;
+
+        /** Return the length of the header */
+        std::size_t headerLength() const
+        { return version ? v1_header_length : v0_header_length; }
+
+        /** Return the size of the packet without the header */
+        std::size_t payloadSize() const
+        { return packetsize - headerLength(); }
+
+        /** Return true if the packet is a fragment of a larger message */
+        bool isFragment() const
+        { return flags & (FLAG_MORE | FLAG_CONTINUED); }
     };
 
+    /** Layout of a version 0 header on the wire */
+    typedef HeaderLayout<
+        HeaderField<byte_traits::byte_t, 0>, // layer identifier
+        HeaderField<byte_traits::uint2b_t, 1>, // size of the whole packet
+        HeaderField<byte_traits::byte_t, 3> // version, always zero
+    > HeaderLayoutV0;
+
+    /** Layout of a version 1 header on the wire */
+    typedef HeaderLayout<
+        HeaderField<byte_traits::byte_t, 0>, // layer identifier
+        HeaderField<byte_traits::byte_t, 1>, // flags
+        HeaderField<byte_traits::byte_t, 2>, // reserved, always zero
+        HeaderField<byte_traits::byte_t, 3>, // version, always one
+        HeaderField<byte_traits::uint4b_t, 4>, // size of the whole packet
+        HeaderField<stream_id_t, 8> // stream of a fragment
+    > HeaderLayoutV1;
+
+    static_assert(HeaderLayoutV0::length == v0_header_length,
+        "Segmentation layer header layout does not match v0_header_length");
+    static_assert(HeaderLayoutV1::length == v1_header_length,
+        "Segmentation layer header layout does not match v1_header_length");
+
+
+    /** Create the header for a packet that is not fragmented.
+    * A version 0 header is used if the packet size fits into it, so packets
+    * can be read by older peers whenever possible.
+    *
+    * @param payload_size Size of the packet without the header
+    */
+    static HeaderType makeHeader(std::size_t payload_size);
+
+    /** Find out the length of a header.
+    *
+    * @tparam InputIterator An Iterator type whos dereferenced type  is
+    * convertible to byte_traits::byte_t. Must meet the
+    * InputIterator requirement.
+    *
+    * @param headerbuf An Iterator to the beginning of a header. Must be at
+    * least min_header_length bytes long.
+    * @throws InvalidHeaderError if the layer identifier or the version is
+    * invalid.
+    */
+    template <typename InputIterator>
+    static std::size_t peekHeaderLength(InputIterator headerbuf);
 
     /** Header decoding function.
     *
@@ -330,11 +445,63 @@ struct SegmentationLayerBase
     * InputIterator requirement.
     *
     * @param headerbuf An Iterator to series of bytes containing the header of
-    * a serialized SegmentationLayer message. Must be at header_length bytes
-    * long.
+    * a serialized SegmentationLayer message. Must be at least as long as
+    * peekHeaderLength() returns.
     */
     template <typename InputIterator>
     static HeaderType decodeHeader(InputIterator headerbuf);
+
+    /** Header encoding function.
+    *
+    * Writes a header into a series of bytes.
+    *
+    * @tparam OutputIterator An Iterator type whos dereferenced type is
+    * assignable from byte_traits::byte_t.
+    *
+    * @param headerbuf Iterator to the buffer the header will be written to.
+    * The buffer must be at least header.headerLength() bytes long.
+    * @param header The header
+    *
+    * @returns An iterator pointing past the written header.
+    */
+    template <typename OutputIterator>
+    static OutputIterator
+    encodeHeader(OutputIterator headerbuf, const HeaderType& header);
+
+    /** Return the number of bytes needed to send a payload.
+    * Payloads that don't fit into a single packet are split into fragments.
+    *
+    * @param payload_size Size of the serialized message
+    * @param max_packetsize Maximum size of a packet, including the header
+    * @throws std::invalid_argument if max_packetsize leaves no room for a
+    * payload.
+    */
+    static std::size_t segmentedSize(
+        std::size_t payload_size,
+        std::size_t max_packetsize
+    );
+
+    /** Turn a payload into packets.
+    *
+    * The payload must be at the end of the buffer, which is
+    * segmentedSize(payload_size, max_packetsize) bytes long. If the payload
+    * fits into one packet, only the header is written in front of it.
+    * Otherwise the payload is split into fragments, which are moved to the
+    * front of the buffer, each behind its header.
+    *
+    * @param buffer The buffer
+    * @param payload_size Size of the payload
+    * @param max_packetsize Maximum size of a packet, including the header
+    * @param stream_id Identifier of the fragments, must not be 0. Fragments
+    * of different messages that are sent at the same time must have
+    * different identifiers.
+    */
+    static void segmentInPlace(
+        byte_traits::byte_sequence& buffer,
+        std::size_t payload_size,
+        std::size_t max_packetsize,
+        stream_id_t stream_id
+    );
 };
 
 
@@ -344,12 +511,25 @@ struct SegmentationLayerBase
 * This class should be used as the lowest layer of a message - the one that
 * shall be sent over the network. The next level lower than this one is the TCP
 * layer.
-* This class tags messages with a binary header in the following layout:
-* Bits
+* This class tags messages with a binary header in one of two layouts.
+* Version 0, used if the packet is smaller than 64 KiB:
+* Bytes
 * 0:      Layer Identifier, Value 0x80
 * 1-2:    Packet size in Network Byte Order
-* 3:      Zero, Value 0x0
+* 3:      Version, Value 0x0
+*
+* Version 1:
+* Bytes
+* 0:      Layer Identifier, Value 0x80
+* 1:      Flags, see SegmentationLayerBase::flags_t
+* 2:      Zero, Value 0x0
+* 3:      Version, Value 0x1
+* 4-7:    Packet size in Network Byte Order
+* 8-11:   Stream identifier of a fragment, zero otherwise
 *
+* Messages larger than the maximum packet size are split into fragments by
+* SegmentationLayerBase::segmentInPlace() and put back together by a
+* FragmentAssembler.
 */
 template <typename InnerLayer>
 struct SegmentationLayer
@@ -378,11 +558,14 @@ struct SegmentationLayer
 
     // overriding base class version
     std::size_t size() const
-    { return _inner_layer.size() + header_length; }
+    { return makeHeader(_inner_layer.size()).packetsize; }
 
     // overriding base class version
     template <typename ByteOutputIterator>
     ByteOutputIterator fillSerialized(ByteOutputIterator it) const;
+
+    // overriding base class version
+    void fillBuffers(GatherBuffers& buffers) const;
 };
 
 
@@ -446,65 +629,139 @@ struct StringwrapLayer : public BasicMessageLayer<StringwrapLayer>
     // overriding base class version
     template <typename ByteOutputIterator>
     ByteOutputIterator fillSerialized(ByteOutputIterator it) const;
+
+    // overriding base class version
+    void fillBuffers(GatherBuffers& buffers) const
+    {
+        // characters are bytes, so the string is already in network byte
+        // order and can be referenced as it is
+        static_assert(
+            netbo_is_identity<byte_traits::msg_string::value_type>::value,
+            "Message strings must be sent as they are stored");
+
+        buffers.appendPayload(
+            reinterpret_cast<const byte_traits::byte_t*>(
+                _message_string.data()),
+            size()
+        );
+    }
 };
 
 
+template <typename InputIterator>
+std::size_t SegmentationLayerBase::peekHeaderLength(InputIterator headerbuf)
+{
+    byte_traits::byte_t layer_id, version;
+
+    layer_id = *headerbuf;
+    version = *(headerbuf + 3);
+
+    if (layer_id != LAYER_ID || version > 1)
+        throw InvalidHeaderError();
+
+    return version ? v1_header_length : v0_header_length;
+}
+
 template <typename InputIterator>
 SegmentationLayerBase::HeaderType
 SegmentationLayerBase::decodeHeader(InputIterator headerbuf)
 {
     HeaderType headerdata;
+    byte_traits::byte_t layer_id, reserved;
 
-    // check first byte to be the correct layer identifier
-    if ( headerbuf[0] !=
-        static_cast<byte_traits::byte_t>(SegmentationLayerBase::LAYER_ID) )
-        throw InvalidHeaderError();
+    if (peekHeaderLength(headerbuf) == v0_header_length)
+    {
+        byte_traits::uint2b_t packetsize;
 
-    // get the size of the packet
-    readbytes<byte_traits::uint2b_t>(&headerdata.packetsize, &headerbuf[1]);
+        HeaderLayoutV0::decode(
+            headerbuf, layer_id, packetsize, headerdata.version);
 
-    headerdata.packetsize = to_hostbo(headerdata.packetsize);
+        headerdata.flags = 0;
+        headerdata.packetsize = packetsize;
+        headerdata.stream_id = 0;
+    }
+    else
+    {
+        HeaderLayoutV1::decode(
+            headerbuf, layer_id, headerdata.flags, reserved,
+            headerdata.version, headerdata.packetsize, headerdata.stream_id);
+
+        // unknown flags, or a fragment without stream and vice versa
+        if (reserved != 0
+            || (headerdata.flags & ~(FLAG_MORE | FLAG_CONTINUED))
+            || headerdata.isFragment() != (headerdata.stream_id != 0))
+            throw InvalidHeaderError();
+    }
 
-    if (headerbuf[3] != 0)
-        throw InvalidHeaderError{};
+    if (headerdata.packetsize < headerdata.headerLength())
+        throw InvalidHeaderError();
 
     return headerdata;
 }
 
+extern template
+std::size_t SegmentationLayerBase::peekHeaderLength(
+    byte_traits::byte_sequence::iterator headerbuf);
 extern template
 SegmentationLayerBase::HeaderType SegmentationLayerBase::decodeHeader(
     byte_traits::byte_sequence::iterator headerbuf);
 
 
+template <typename OutputIterator>
+OutputIterator
+SegmentationLayerBase::encodeHeader(
+    OutputIterator headerbuf,
+    const HeaderType& header
+)
+{
+    if (header.version == 0)
+        return HeaderLayoutV0::encode(
+            headerbuf,
+            LAYER_ID,
+            static_cast<byte_traits::uint2b_t>(header.packetsize),
+            0
+        );
+
+    return HeaderLayoutV1::encode(
+        headerbuf,
+        LAYER_ID,
+        header.flags,
+        0,
+        1,
+        header.packetsize,
+        header.stream_id
+    );
+}
+
+
 // overriding base class version
 template <typename InnerLayer>
 template <typename ByteOutputIterator>
 ByteOutputIterator
 SegmentationLayer<InnerLayer>::fillSerialized(ByteOutputIterator it) const
 {
-    // first byte is layer identifier
-    *it++ = static_cast<byte_traits::byte_t>(LAYER_ID);
+    it = encodeHeader(it, makeHeader(_inner_layer.size()));
 
-    // second and third bytes are the size of the whole packet
-    it = writebytes(it, to_netbo(
-        static_cast<byte_traits::uint2b_t>(_inner_layer.size()+header_length)));
+    // the rest is the message
+    return _inner_layer.fillSerialized(it);
+}
 
-    // fourth byte is a zero
-    *it++ = 0;
+// overriding base class version
+template <typename InnerLayer>
+void SegmentationLayer<InnerLayer>::fillBuffers(GatherBuffers& buffers) const
+{
+    HeaderType header = makeHeader(_inner_layer.size());
+    encodeHeader(buffers.appendHeader(header.headerLength()), header);
 
     // the rest is the message
-    return _inner_layer.fillSerialized(it);
+    _inner_layer.fillBuffers(buffers);
 }
 
 template <typename ByteOutputIterator>
 ByteOutputIterator StringwrapLayer::fillSerialized(ByteOutputIterator it) const
 {
-    // write all bytes of one character into the buffer, advance the output
-    // iterator
-    for (auto in_it  = _message_string.begin(); in_it < _message_string.end(); in_it++)
-        it = writebytes(it, to_netbo(*in_it));
-
-    return it;
+    // write all characters into the buffer in network byte order
+    return writesequence(it, _message_string.data(), _message_string.size());
 }
 
 extern template
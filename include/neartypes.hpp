@@ -30,6 +30,7 @@
 #include <iostream>
 #include <algorithm>
 #include <cstring>
+#include <boost/utility/string_ref.hpp>
 
 #include "bytes.hpp"
 #include "msglayer.hpp"
@@ -97,6 +98,10 @@ struct UniqueUserID
  *
  * This class shall be used, whenever a client sends a message to another client
  * that is connected to the same server.
+ *
+ * A message without recipient and without text announces the sender to the
+ * server, so the server delivers messages for the sender to this client. The
+ * server does not relay it.
 */
 struct NearUserMessage : BasicMessageLayer<NearUserMessage>
 {
@@ -108,6 +113,22 @@ struct NearUserMessage : BasicMessageLayer<NearUserMessage>
     static constexpr std::size_t header_length =
         1+ sizeof(msg_id_t) + UniqueUserID::id_length + UniqueUserID::id_length;
 
+    /** Fields of the header */
+    typedef HeaderField<byte_traits::byte_t, 0> LayerIdField;
+    typedef HeaderField<msg_id_t, 1> MsgIdField;
+    typedef HeaderField<decltype(UniqueUserID::id), 1 + sizeof(msg_id_t)>
+        RecipientField;
+    typedef HeaderField<decltype(UniqueUserID::id),
+        1 + sizeof(msg_id_t) + UniqueUserID::id_length> SenderField;
+
+    /** Layout of the header on the wire */
+    typedef HeaderLayout<
+        LayerIdField, MsgIdField, RecipientField, SenderField
+    > HeaderLayoutType;
+
+    static_assert(HeaderLayoutType::length == header_length,
+        "NearUserMessage header layout does not match header_length");
+
 
     explicit NearUserMessage(const NearUserMessage&) = default;
     NearUserMessage& operator= (const NearUserMessage&) = default;
@@ -167,6 +188,25 @@ struct NearUserMessage : BasicMessageLayer<NearUserMessage>
     template <typename ByteOutputIterator>
     ByteOutputIterator fillSerialized(ByteOutputIterator it) const;
 
+    // implementing base class version
+    void fillBuffers(GatherBuffers& buffers) const;
+
+    /** Serialize a message without creating a NearUserMessage object.
+     * The bytes are the same that fillSerialized() writes for a message with
+     * these fields, but the string is not copied into the message first.
+     * The buffer must have header_length + msg.size() bytes.
+     *
+     * @returns An iterator pointing past the filled range in the buffer.
+    */
+    template <typename ByteOutputIterator>
+    static ByteOutputIterator serialize(
+        ByteOutputIterator it,
+        msg_id_t msg_id,
+        const UniqueUserID& recipient,
+        const UniqueUserID& sender,
+        const byte_traits::msg_string& msg
+    );
+
 
     /** ID of the message.
      * This object can be used to identify the message uniquely. This is
@@ -193,33 +233,297 @@ struct NearUserMessage : BasicMessageLayer<NearUserMessage>
 template <typename ByteOutputIterator>
 ByteOutputIterator NearUserMessage::fillSerialized(ByteOutputIterator it) const
 {
-    // first byte is layer identifier
-    *it++ = static_cast<byte_traits::byte_t>(LAYER_ID);
+    return serialize(
+        it, _msg_id, _recipient, _sender, _stringwrap._message_string);
+}
+
+template <typename ByteOutputIterator>
+ByteOutputIterator NearUserMessage::serialize(
+    ByteOutputIterator it,
+    msg_id_t msg_id,
+    const UniqueUserID& recipient,
+    const UniqueUserID& sender,
+    const byte_traits::msg_string& msg
+)
+{
+    // layer identifier, message id, recipient and sender
+    it = HeaderLayoutType::encode(
+        it, LAYER_ID, msg_id, recipient.id, sender.id);
 
-    // next four bytes are the message id
-    it = writebytes(
-        it,
-        to_netbo(_msg_id)
+    // the rest is the message string
+    return writesequence(it, msg.data(), msg.size());
+}
+
+inline void NearUserMessage::fillBuffers(GatherBuffers& buffers) const
+{
+    HeaderLayoutType::encode(buffers.appendHeader(header_length),
+        LAYER_ID, _msg_id, _recipient.id, _sender.id);
+
+    _stringwrap.fillBuffers(buffers);
+}
+
+
+/** Read-only view of a serialized user message.
+ *
+ * Constructing a NearUserMessage from received data decodes the whole header
+ * and copies the message string. Routing a message only needs the recipient
+ * and forwarding it needs nothing at all, so this class only checks the
+ * header. The fields are decoded when they are asked for and the message
+ * string is never copied.
+ *
+ * The view shares the ownership of the memory block the message is stored
+ * in, so it stays valid as long as the view is alive.
+*/
+class NearUserMessageView
+{
+public:
+    typedef NearUserMessage::msg_id_t msg_id_t;
+
+    /** Check whether data holds a user message.
+     * @returns true if the data is long enough for the header and starts
+     * with the layer identifier of NearUserMessage.
+    */
+    static bool isUserMessage(const SerializedData& data)
+    {
+        return data.size() >= NearUserMessage::header_length
+            && *data.begin() == NearUserMessage::LAYER_ID;
+    }
+
+    /** Constructor.
+     * The data is not copied, the view references the same memory block.
+     *
+     * @param data Serialized Data layer
+     *
+     * @throw UndersizedPacketError when the datasize is less than the minimum
+     * packet header
+     * @throw InvalidHeaderError if the first byte of the data does not contain
+     * the correct layer identifier.
+    */
+    explicit NearUserMessageView(const SerializedData& data)
+        : _data(data.getOwnership(), data.begin(), data.size())
+    { checkHeader(); }
+
+    explicit NearUserMessageView(SerializedData&& data)
+        : _data(std::move(data))
+    { checkHeader(); }
+
+    /** ID of the message */
+    msg_id_t msg_id() const
+    {
+        return NearUserMessage::HeaderLayoutType::decodeField<
+            NearUserMessage::MsgIdField>(_data.begin());
+    }
+
+    /** Who the message is intended to */
+    UniqueUserID recipient() const
+    {
+        return UniqueUserID(NearUserMessage::HeaderLayoutType::decodeField<
+            NearUserMessage::RecipientField>(_data.begin()));
+    }
+
+    /** Who sent the message */
+    UniqueUserID sender() const
+    {
+        return UniqueUserID(NearUserMessage::HeaderLayoutType::decodeField<
+            NearUserMessage::SenderField>(_data.begin()));
+    }
+
+    /** The message string, referenced where it is stored.
+     * The returned reference is valid as long as this view is alive.
+    */
+    boost::string_ref body() const
+    {
+        // characters are bytes, so the string is stored as it is sent
+        static_assert(
+            netbo_is_identity<byte_traits::msg_string::value_type>::value,
+            "Message strings must be received as they are stored");
+
+        std::size_t length = _data.size() - NearUserMessage::header_length;
+
+        return length ?
+            boost::string_ref(reinterpret_cast<const char*>(
+                &*(_data.begin() + NearUserMessage::header_length)), length) :
+            boost::string_ref();
+    }
+
+    /** The whole serialized message, e.g. to forward it. */
+    const SerializedData& data() const
+    { return _data; }
+
+    /** Decode the message, copying the message string. */
+    NearUserMessage decode() const
+    { return NearUserMessage(_data); }
+
+private:
+    SerializedData _data;
+
+    void checkHeader() const
+    {
+        if (_data.size() < NearUserMessage::header_length)
+            throw UndersizedPacketError();
+
+        if (*_data.begin() != NearUserMessage::LAYER_ID)
+            throw InvalidHeaderError();
+    }
+};
+
+
+/** Class representing a message concerning a channel
+ *
+ * Channels are groups of clients on the same server. A client subscribes to
+ * a channel to receive all messages that are published to it. The server
+ * handles subscriptions itself, published messages are relayed to all
+ * subscribers of the channel except the publisher.
+*/
+struct ChannelMessage : BasicMessageLayer<ChannelMessage>
+{
+    /** Type for a more or less unique message identifier */
+    typedef NearUserMessage::msg_id_t msg_id_t;
+
+    /** Type for a channel identifier */
+    typedef byte_traits::uint4b_t channel_id_t;
+
+    /** What the message is about */
+    enum operation_t : byte_traits::byte_t
+    {
+        OP_SUBSCRIBE = 1,   /**< Subscribe the sending client to the channel */
+        OP_UNSUBSCRIBE = 2, /**< Unsubscribe the sending client */
+        OP_PUBLISH = 3      /**< Send the message to all subscribers */
+    };
+
+    /**< Layer Identifier */
+    static constexpr byte_traits::byte_t LAYER_ID = 0x42;
+    static constexpr std::size_t header_length =
+        1 + 1 + sizeof(msg_id_t) + sizeof(channel_id_t) +
+        UniqueUserID::id_length;
+
+    /** Layout of the header on the wire */
+    typedef HeaderLayout<
+        // layer identifier
+        HeaderField<byte_traits::byte_t, 0>,
+        // operation
+        HeaderField<byte_traits::byte_t, 1>,
+        // message id
+        HeaderField<msg_id_t, 2>,
+        // channel
+        HeaderField<channel_id_t, 2 + sizeof(msg_id_t)>,
+        // sender
+        HeaderField<decltype(UniqueUserID::id),
+            2 + sizeof(msg_id_t) + sizeof(channel_id_t)>
+    > HeaderLayoutType;
+
+    static_assert(HeaderLayoutType::length == header_length,
+        "ChannelMessage header layout does not match header_length");
+
+
+    explicit ChannelMessage(const ChannelMessage&) = default;
+    ChannelMessage& operator= (const ChannelMessage&) = default;
+
+    ChannelMessage(ChannelMessage&&) = default;
+    ChannelMessage& operator= (ChannelMessage&&) = default;
+
+    /** Constructor.
+     * @param operation What the message is about
+     * @param channel The channel
+     * @param stringwrap The message, only used for OP_PUBLISH
+     * @param from sender of the message
+     * @param msg_id use this as message identifier
+    */
+    ChannelMessage(
+        operation_t operation,
+        channel_id_t channel,
+        StringwrapLayer&& stringwrap = StringwrapLayer(),
+        const UniqueUserID& from = UniqueUserID(),
+        msg_id_t msg_id = msg_id_t()
+    )
+        : _msg_id(msg_id), _operation(operation), _channel(channel),
+            _sender(from), _stringwrap(std::move(stringwrap))
+    { }
+
+    /** Construct from serialized Data
+     *
+     * @param data Serialized Data layer
+     *
+     * @throw UndersizedPacketError when the datasize is less than the minimum
+     * packet header
+     * @throw InvalidHeaderError if the first byte of the data does not contain
+     * the correct layer identifier, or the operation is unknown.
+    */
+    ChannelMessage(const SerializedData& data);
+
+    // implementing base class version
+    std::size_t size() const
+    { return header_length + _stringwrap.size(); }
+
+    // implementing base class version
+    template <typename ByteOutputIterator>
+    ByteOutputIterator fillSerialized(ByteOutputIterator it) const;
+
+    // implementing base class version
+    void fillBuffers(GatherBuffers& buffers) const;
+
+    /** Read the operation and channel of a serialized message.
+     * Only the header is decoded, the message string is left alone.
+     *
+     * @param data Serialized Data layer, may be any kind of message
+     * @param operation Is set to the operation of the message
+     * @param channel Is set to the channel of the message
+     * @return false if the data is not a valid ChannelMessage header
+    */
+    static bool peekHeader(
+        const SerializedData& data,
+        operation_t& operation,
+        channel_id_t& channel
     );
 
-    // recipient
-    it = _recipient.fillSerialized(it);
 
-    // sender
-    it = _sender.fillSerialized(it);
+    /** ID of the message */
+    msg_id_t _msg_id;
+
+    /** What the message is about */
+    operation_t _operation;
+
+    /** The channel the message is about */
+    channel_id_t _channel;
+
+    /** Who sent this message */
+    UniqueUserID _sender;
+
+    /** The message, empty unless the operation is OP_PUBLISH */
+    StringwrapLayer _stringwrap;
+};
+
+
+template <typename ByteOutputIterator>
+ByteOutputIterator ChannelMessage::fillSerialized(ByteOutputIterator it) const
+{
+    it = HeaderLayoutType::encode(
+        it, LAYER_ID, _operation, _msg_id, _channel, _sender.id);
 
     // the rest is the message string
     return _stringwrap.fillSerialized(it);
 }
 
+inline void ChannelMessage::fillBuffers(GatherBuffers& buffers) const
+{
+    HeaderLayoutType::encode(buffers.appendHeader(header_length),
+        LAYER_ID, _operation, _msg_id, _channel, _sender.id);
+
+    _stringwrap.fillBuffers(buffers);
+}
+
 
 /**@}*/ // addtogroup common
 
 extern template class BasicMessageLayer<NearUserMessage>;
 extern template class SegmentationLayer<NearUserMessage>;
+extern template class BasicMessageLayer<ChannelMessage>;
+extern template class SegmentationLayer<ChannelMessage>;
 
 extern template byte_traits::byte_sequence::iterator
 NearUserMessage::fillSerialized(byte_traits::byte_sequence::iterator it) const;
+extern template byte_traits::byte_sequence::iterator
+ChannelMessage::fillSerialized(byte_traits::byte_sequence::iterator it) const;
 
 
 } // namespace nuke_ms
@@ -26,13 +26,10 @@
 #ifndef REFCOUNTER_HPP
 #define REFCOUNTER_HPP
 
+#include <cassert>
+#include <atomic>
 #include <boost/function.hpp>
 
-
-#ifndef NUKE_MS_REFCOUNTER_NOT_MULTITHREADED
-#   include <boost/thread/mutex.hpp>
-#endif
-
 /** Count references to the current object.
 * This class is used to maintain track of the references to the current object.
 * This can be usefull if the lifetime of an object is dependent on the
@@ -46,7 +43,12 @@
 * destruction will decrease the reference count.
 *
 * When the reference count reaches zero by decreasing, the action specified in
-* the constructor will be executed.
+* the constructor will be executed. If several threads release references
+* concurrently, the action is executed exactly once, by the thread that
+* released the last reference.
+*
+* The reference count is an atomic variable, so creating and destroying
+* references is thread safe without locking a mutex.
 *
 * @tparam The type of the deriving class
 */
@@ -56,7 +58,7 @@ class ReferenceCounter
     /**< Action that will be executed when the reference count reaches zero */
     boost::function<void ()> action;
 
-    unsigned reference_count; /**< Number of counted references */
+    std::atomic<unsigned> reference_count; /**< Number of counted references */
 
 public:
 
@@ -140,16 +142,12 @@ protected:
     {}
 
     /** Return reference count.
+    * If the count is zero, everything done through the released references
+    * happened before this function returned.
     * @return Number of counted references
     */
     inline unsigned getRefCount() const
-    { return reference_count; }
-
-#ifndef NUKE_MS_REFCOUNTER_NOT_MULTITHREADED
-    /// mutex that ensures thread safe acces to the reference count
-    boost::mutex reference_mutex;
-#endif
-
+    { return reference_count.load(std::memory_order_acquire); }
 
 private:
     // CountedReference is our friend
@@ -160,17 +158,14 @@ private:
 
     /** Increase reference count.
     * To be called only by the constructor of a CountedReference object.
+    * A new reference is always created from an existing one or from the
+    * referenced object itself, so no ordering is needed here.
     *
     * @post reference_count increased by one
-    * @note In multithreaded builds this function locks a mutex during execution
     */
     inline void increaseRefCount ()
     {
-#ifndef NUKE_MS_REFCOUNTER_NOT_MULTITHREADED
-        /// mutex that ensures thread safe acces to the reference count
-        boost::mutex::scoped_lock lock(reference_mutex);
-#endif
-        ++reference_count;
+        reference_count.fetch_add(1u, std::memory_order_relaxed);
     }
 
     /** Decrease reference count
@@ -178,23 +173,25 @@ private:
     *
     * If the reference_count reaches zero after decreasing, and an action
     * was specified in the constructor, the action is executed.
+    * Releasing a reference publishes everything done through it, and the
+    * action sees everything done through all released references.
     *
     * @post reference_count decreased by one
-    * @note In multithreaded builds this function locks a mutex during execution
     */
     inline void decreaseRefCount ()
     {
-#ifndef NUKE_MS_REFCOUNTER_NOT_MULTITHREADED
-        /// mutex that ensures thread safe acces to the reference count
-        boost::mutex::scoped_lock lock(reference_mutex);
-#endif
+        unsigned previous_count =
+            reference_count.fetch_sub(1u, std::memory_order_release);
 
-        --reference_count;
+        assert (previous_count > 0u);
 
-        if (reference_count <= 0u && action)
-            action();
+        if (previous_count == 1u)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
 
-        assert (reference_count >= 0);
+            if (action)
+                action();
+        }
     }
 
 };
@@ -0,0 +1,121 @@
+// segmentationreader.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file segmentationreader.hpp
+* @ingroup common
+* @brief Splitting a byte stream into segmentation layer packets
+*
+* Receiving the header and the body of every packet with a read operation of
+* their own costs two system calls per packet. Instead, the
+* SegmentationStreamReader lets the caller read as much data as is available
+* into a large buffer, and then extracts all complete packets from it.
+*/
+
+#ifndef SEGMENTATIONREADER_HPP_INCLUDED
+#define SEGMENTATIONREADER_HPP_INCLUDED
+
+#include <boost/asio/buffer.hpp>
+
+#include "msglayer.hpp"
+#include "bufferpool.hpp"
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Splits a received byte stream into segmentation layer packets.
+*
+* Usage: read into the buffer returned by prepare(), pass the number of bytes
+* read to commit() and then call nextPacket() until it returns false.
+*
+* Packets are not copied out of the receive buffer, they reference the chunk
+* of memory they were received into. As long as no packet references the
+* current chunk, an incomplete packet at the end is moved to the front of the
+* chunk. Otherwise a new chunk is taken from the BufferPool and the incomplete
+* packet is copied into it, so packets that are still in use stay untouched.
+*
+* This class is not thread safe.
+*/
+class SegmentationStreamReader
+{
+public:
+    /** Constructor.
+    * @param max_packetsize The maximum size of a packet, including the header.
+    * Larger packets are rejected.
+    * @param chunk_size Size of the buffer chunks that are read into.
+    */
+    explicit SegmentationStreamReader(
+        std::size_t max_packetsize,
+        std::size_t chunk_size = BufferPool::max_class_size
+    );
+
+    /** Return a buffer that the next read operation shall fill.
+    * The buffer is valid until the next call to commit().
+    * Call nextPacket() until it returns false before calling this function.
+    */
+    boost::asio::mutable_buffers_1 prepare();
+
+    /** Mark bytes as received.
+    * @param bytes_transferred Number of bytes that were read into the buffer
+    * returned by prepare().
+    */
+    void commit(std::size_t bytes_transferred);
+
+    /** Extract the next complete packet.
+    *
+    * @param packet Will be set to the packet, including the segmentation
+    * layer header. Unchanged if there is no complete packet.
+    * @returns true if a packet was extracted, false if more data has to be
+    * received first.
+    * @throws InvalidHeaderError if the header of the packet is invalid.
+    * @throws OversizedPacketError if the packet is too big.
+    */
+    bool nextPacket(SerializedData& packet);
+
+private:
+    /** Maximum size of a packet */
+    const std::size_t _max_packetsize;
+
+    /** Default size of a chunk */
+    const std::size_t _chunk_size;
+
+    /** Current chunk */
+    BufferPool::buffer_ptr_t _buffer;
+
+    /** Offset of the first byte that was not extracted yet */
+    std::size_t _begin;
+
+    /** Offset of the first byte that was not received yet */
+    std::size_t _end;
+
+    /** Make sure the current chunk has enough room to receive the rest of
+    * the incomplete packet, if its size is known, or a reasonable amount of
+    * data otherwise.
+    */
+    void makeRoom();
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef SEGMENTATIONREADER_HPP_INCLUDED
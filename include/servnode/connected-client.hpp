@@ -20,14 +20,20 @@
 #ifndef CONNECTED_CLIENT_HPP_INCLUDED
 #define CONNECTED_CLIENT_HPP_INCLUDED
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
 
 #include "neartypes.hpp"
+#include "bufferpool.hpp"
+#include "segmentationreader.hpp"
+#include "fragmentassembler.hpp"
 
 namespace nuke_ms
 {
@@ -43,6 +49,41 @@ class ConnectedClient
     boost::asio::io_service& io_service;
     boost::asio::ip::tcp::socket socket;
 
+    /** Packets waiting to be written. Protected by send_mutex. */
+    std::vector<std::shared_ptr<const GatherBuffers>> send_queue;
+
+    /** True while a write operation is in progress. Protected by send_mutex */
+    bool write_in_progress;
+
+    /** True if shutdown() was called while a write was in progress.
+    * Protected by send_mutex */
+    bool shutdown_requested;
+
+    /** Mutex protecting the send queue */
+    boost::mutex send_mutex;
+
+    /** Packets of the write operation currently in progress */
+    std::vector<std::shared_ptr<const GatherBuffers>> writing_packets;
+
+    /** Splits the received data into packets */
+    SegmentationStreamReader reader;
+
+    /** Puts fragmented messages back together */
+    FragmentAssembler assembler;
+
+    /** The stream identifier of the last fragmented message that was sent */
+    std::atomic<SegmentationLayerBase::stream_id_t> next_stream_id;
+
+    /** The fragments of a message, serialized into one buffer */
+    struct SegmentedMessage
+    {
+        BufferPool::buffer_ptr_t buffer;
+        std::size_t size;
+
+        void fillBuffers(GatherBuffers& buffers) const
+        { buffers.appendPayload(&*buffer->begin(), size); }
+    };
+
     // private constructor
     ConnectedClient(
         connection_id_t connection_id,
@@ -55,11 +96,37 @@ class ConnectedClient
     // copy construction disallowed
     ConnectedClient(const ConnectedClient&) = delete;
 
-    void async_write(std::shared_ptr<byte_traits::byte_sequence> data);
+    /** Queue a packet for writing.
+    * Only one write operation is in progress at a time, packets queued in
+    * the meantime are written with a single gathering write afterwards.
+    */
+    void async_write(std::shared_ptr<const GatherBuffers> data);
+
+    /** Write all queued packets.
+    * @pre write_in_progress was set by the caller
+    */
+    void startWrite();
+
+    /** Shut down the socket immediately, discarding queued packets */
+    void shutdownNow();
+
+    /** Return a stream identifier for the fragments of the next message.
+    * This function is thread safe.
+    */
+    SegmentationLayerBase::stream_id_t nextStreamId()
+    {
+        SegmentationLayerBase::stream_id_t stream_id;
+
+        // zero means "no stream"
+        do
+            stream_id = ++next_stream_id;
+        while (!stream_id);
+
+        return stream_id;
+    }
 
     friend class SendHandler;
-    friend class ReceiveHeaderHandler;
-    friend class ReceiveBodyHandler;
+    friend class ReceiveHandler;
 public:
     struct Signals
     {
@@ -88,8 +155,7 @@ public:
         void disconnectDisconnected() { disconnected.disconnect_all_slots(); }
 
         friend class SendHandler;
-        friend class ReceiveHeaderHandler;
-        friend class ReceiveBodyHandler;
+        friend class ReceiveHandler;
 
     private:
         ReceivedMessage receivedMessage;
@@ -114,30 +180,59 @@ public:
 
     void startReceive();
 
+    /** Shut down the connection.
+    * If packets are queued for writing, the connection is shut down after
+    * they have been written.
+    */
     void shutdown();
 
+    /** Send a packet.
+    * The packet is copied, the copy is kept until it has been written.
+    */
     template <typename InnerLayer>
-    void sendPacket(const SegmentationLayer<InnerLayer>& packet);
+    void sendPacket(const SegmentationLayer<InnerLayer>& packet)
+    {
+        // create own copy and redirect
+        SegmentationLayer<InnerLayer> data{InnerLayer(packet._inner_layer)};
+        sendPacket(std::move(data));
+    }
 
+    /** Send a packet.
+    * The packet is kept until it has been written. Its payload is written
+    * from where it is stored, it is not serialized into a new buffer.
+    * Payloads that don't fit into a single packet are serialized into a
+    * pooled buffer and split into fragments.
+    */
     template <typename InnerLayer>
     void sendPacket(SegmentationLayer<InnerLayer>&& packet)
     {
-        // create own copy and redirect
-        SegmentationLayer<InnerLayer> data{std::move(packet)};
-        sendPacket(data);
+        const std::size_t max_packetsize =
+            SegmentationLayerBase::default_max_packetsize;
+        std::size_t payload_size = packet._inner_layer.size();
+
+        if (SegmentationLayerBase::makeHeader(payload_size).packetsize
+            <= max_packetsize)
+        {
+            this->async_write(gatherMessage(std::move(packet)));
+            return;
+        }
+
+        // serialize to the end of the buffer, the fragment headers are put
+        // in front of it
+        std::size_t size =
+            SegmentationLayerBase::segmentedSize(payload_size, max_packetsize);
+        BufferPool::buffer_ptr_t buffer = BufferPool::instance()->acquire(size);
+
+        packet._inner_layer.fillSerialized(
+            buffer->begin() + (size - payload_size));
+        SegmentationLayerBase::segmentInPlace(
+            *buffer, payload_size, max_packetsize, nextStreamId());
+
+        this->async_write(
+            gatherMessage(SegmentedMessage{std::move(buffer), size}));
     }
 };
 
-template <typename InnerLayer>
-void ConnectedClient::sendPacket(const SegmentationLayer<InnerLayer>& packet)
-{
-    // create buffer, fill it with the serialized packet
-    auto data = std::make_shared<byte_traits::byte_sequence>(packet.size());
-    packet.fillSerialized(data->begin());
-
-    this->async_write(data);
-}
-
 
 } // namespace servnode
 } // namespace nuke_ms
@@ -0,0 +1,199 @@
+// slottable.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** @file slottable.hpp
+* @ingroup common
+* @brief Container with stable identifiers and contiguous storage
+*/
+
+#ifndef SLOTTABLE_HPP_INCLUDED
+#define SLOTTABLE_HPP_INCLUDED
+
+#include <vector>
+#include <stdexcept>
+
+namespace nuke_ms
+{
+
+/** @addtogroup common
+ * @{
+*/
+
+/** Container that hands out an identifier for every inserted element.
+*
+* Lookup by identifier is a constant time array access. The elements are kept
+* in a contiguous array, so iterating over all of them is as fast as iterating
+* over a std::vector. The order of the elements is unspecified.
+*
+* An identifier consists of the index of a slot and the generation of the
+* slot. Slots of erased elements are reused, but their generation is
+* increased, so an identifier of an erased element does not find the element
+* that reuses its slot.
+* Identifiers are always greater than zero.
+*
+* This class is not thread safe.
+*
+* @tparam T Type of the elements
+*/
+template <typename T>
+class SlotTable
+{
+public:
+    /** Type of the identifiers */
+    typedef int id_type;
+
+    typedef typename std::vector<T>::iterator iterator;
+    typedef typename std::vector<T>::const_iterator const_iterator;
+
+    /** Number of bits of an identifier used for the slot index */
+    static constexpr unsigned index_bits = 20;
+
+    /** Maximum number of elements */
+    static constexpr std::size_t max_size = std::size_t(1) << index_bits;
+
+    /** Insert an element.
+    * @param value The element
+    * @returns The identifier of the element.
+    * @throws std::length_error if the table is full
+    */
+    id_type insert(T value)
+    {
+        unsigned slot_index;
+
+        if (!free_slots.empty())
+        {
+            slot_index = free_slots.back();
+            free_slots.pop_back();
+        }
+        else
+        {
+            if (slots.size() == max_size)
+                throw std::length_error("SlotTable is full");
+
+            slot_index = static_cast<unsigned>(slots.size());
+            slots.push_back(Slot{1, 0});
+        }
+
+        values.push_back(std::move(value));
+        value_slots.push_back(slot_index);
+        slots[slot_index].value_index =
+            static_cast<unsigned>(values.size() - 1);
+
+        return makeId(slot_index, slots[slot_index].generation);
+    }
+
+    /** Find an element.
+    * @returns A pointer to the element, or a null pointer if there is no
+    * element with this identifier. The pointer is valid until the next
+    * insertion or removal.
+    */
+    T* find(id_type id)
+    {
+        unsigned value_index;
+        return lookup(id, value_index) ? &values[value_index] : nullptr;
+    }
+
+    /** Remove an element.
+    * @returns true if the element was removed, false if there was no element
+    * with this identifier.
+    */
+    bool erase(id_type id)
+    {
+        unsigned value_index;
+        if (!lookup(id, value_index))
+            return false;
+
+        unsigned slot_index = id & index_mask;
+
+        // move the last element into the hole
+        if (value_index != values.size() - 1)
+        {
+            values[value_index] = std::move(values.back());
+            value_slots[value_index] = value_slots.back();
+            slots[value_slots[value_index]].value_index = value_index;
+        }
+
+        values.pop_back();
+        value_slots.pop_back();
+
+        // invalidate all identifiers of this slot
+        Slot& slot = slots[slot_index];
+        slot.generation = slot.generation == max_generation ?
+            1 : slot.generation + 1;
+        slot.value_index = invalid_index;
+        free_slots.push_back(slot_index);
+
+        return true;
+    }
+
+    /** Return the number of elements */
+    std::size_t size() const
+    { return values.size(); }
+
+    bool empty() const
+    { return values.empty(); }
+
+    iterator begin() { return values.begin(); }
+    iterator end() { return values.end(); }
+    const_iterator begin() const { return values.begin(); }
+    const_iterator end() const { return values.end(); }
+
+private:
+    struct Slot
+    {
+        unsigned generation;
+        unsigned value_index; /**< Index into values, invalid_index if free */
+    };
+
+    static constexpr unsigned index_mask = (1u << index_bits) - 1;
+    static constexpr unsigned max_generation = (1u << (31 - index_bits)) - 1;
+    static constexpr unsigned invalid_index = ~0u;
+
+    std::vector<Slot> slots;
+    std::vector<unsigned> free_slots;
+
+    std::vector<T> values;
+    std::vector<unsigned> value_slots; /**< Slot index of every value */
+
+    static id_type makeId(unsigned slot_index, unsigned generation)
+    { return static_cast<id_type>((generation << index_bits) | slot_index); }
+
+    bool lookup(id_type id, unsigned& value_index) const
+    {
+        if (id <= 0)
+            return false;
+
+        unsigned slot_index = id & index_mask;
+        unsigned generation = static_cast<unsigned>(id) >> index_bits;
+
+        if (slot_index >= slots.size()
+            || slots[slot_index].generation != generation
+            || slots[slot_index].value_index == invalid_index)
+            return false;
+
+        value_index = slots[slot_index].value_index;
+        return true;
+    }
+};
+
+/**@}*/ // addtogroup common
+
+} // namespace nuke_ms
+
+#endif // ifndef SLOTTABLE_HPP_INCLUDED
@@ -70,7 +70,7 @@ void ClientNode::connectTo(const ServerLocation& where)
     {  // on success, pass on event
 
         // lock the mutex to the machine, process event
-        boost::mutex::scoped_lock(machine_mutex);
+        boost::recursive_mutex::scoped_lock lk(machine_mutex);
         statemachine.process_event(EvtConnectRequest(host, service));
     }
     else // on failure, report back to application
@@ -88,26 +88,70 @@ void ClientNode::connectTo(const ServerLocation& where)
 
 
 NearUserMessage::msg_id_t ClientNode::sendUserMessage(
-    byte_traits::msg_string&& msg,
+    const byte_traits::msg_string& msg,
     const UniqueUserID& recipient
 )
 {
-    NearUserMessage usermsg{std::move(msg), recipient};
-    usermsg._msg_id = getNextMessageId();
+    NearUserMessage::msg_id_t msg_id = getNextMessageId();
+
+    std::size_t payload_size = NearUserMessage::header_length + msg.size();
+    std::size_t packet_size = SegmentationLayerBase::segmentedSize(
+        payload_size, SegmentationLayerBase::default_max_packetsize);
+
+    // serialize the message to the end of a pooled buffer, the state machine
+    // puts the segmentation headers in front of it
+    EvtSendPacket evt{BufferPool::instance()->acquire(packet_size),
+        packet_size, payload_size, msg_id};
+
+    NearUserMessage::serialize(
+        evt.buffer->begin() + (packet_size - payload_size),
+        msg_id, recipient,
+        UniqueUserID(statemachine.user_id.load(std::memory_order_relaxed)),
+        msg);
+
+    // while connected, the message is queued for the I/O thread right away,
+    // otherwise the state machine reports that it could not be sent
+    if (statemachine.connected.load(std::memory_order_acquire))
+        StateConnected::sendPacket(statemachine, evt);
+    else
+    {
+        // lock the mutex to the machine
+        boost::recursive_mutex::scoped_lock lk(machine_mutex);
+        statemachine.process_event(evt);
+    }
+
+    return msg_id;
+}
+
 
-    // lock the mutex to the machine
-    boost::mutex::scoped_lock(machine_mutex);
-    statemachine.process_event(EvtSendMsg<NearUserMessage>{std::move(usermsg)});
 
-    return usermsg._msg_id;
+void ClientNode::setUserId(const UniqueUserID& id)
+{
+    statemachine.user_id.store(id.id);
+
+    // While the connection is being established, the StateConnected
+    // constructor announces the user.
+    if (statemachine.connected.load())
+        StateConnected::announceUser(statemachine);
 }
 
 
+void ClientNode::setBatching(const BatchOptions& options)
+{
+    boost::mutex::scoped_lock lk(statemachine.batch_mutex);
+    statemachine.batch_options = options;
+
+    // write what was held back, if batching was disabled
+    if (!options.max_bytes && !statemachine.batch_writing
+        && !statemachine.batch_queue.empty())
+        StateConnected::scheduleWrite(statemachine);
+}
+
 
 void ClientNode::disconnect()
 {
     // lock the mutex to the machine, dispatch disconnect request
-    boost::mutex::scoped_lock(machine_mutex);
+    boost::recursive_mutex::scoped_lock lk(machine_mutex);
     statemachine.process_event(EvtDisconnectRequest{});
 }
 
@@ -0,0 +1,185 @@
+// logstreams.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <boost/thread/thread.hpp>
+
+#include "boundedqueue.hpp"
+#include "clientnode/logstreams.hpp"
+
+using namespace nuke_ms;
+using namespace clientnode;
+
+
+namespace nuke_ms
+{
+namespace clientnode
+{
+
+/** Queue of log messages and the thread that writes them to a sink */
+class AsyncLogger
+{
+public:
+    explicit AsyncLogger(std::shared_ptr<LogSink> sink_)
+        : sink(sink_), queue(queue_capacity), dropped(0), running(true)
+    {
+        writer_thread = boost::thread(&AsyncLogger::writerLoop, this);
+    }
+
+    /** Destructor, writes all pending messages and stops the thread. */
+    ~AsyncLogger()
+    {
+        running.store(false, std::memory_order_release);
+        writer_thread.join();
+    }
+
+    void submit(LogSeverity severity, LoggingStreams::formatter_t&& formatter)
+    {
+        Record record{severity, std::move(formatter)};
+
+        if (!queue.push(record))
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    struct Record
+    {
+        LogSeverity severity;
+        LoggingStreams::formatter_t formatter;
+    };
+
+    /** Number of messages the queue can hold */
+    static constexpr std::size_t queue_capacity = 1024;
+
+    /** Interval in which the background thread looks for new messages */
+    static constexpr unsigned poll_interval_ms = 10;
+
+    std::shared_ptr<LogSink> sink;
+
+    BoundedQueue<Record> queue;
+
+    /** Number of messages dropped because the queue was full */
+    std::atomic<unsigned long> dropped;
+
+    std::atomic<bool> running;
+    boost::thread writer_thread;
+
+    void writerLoop()
+    {
+        while (running.load(std::memory_order_acquire))
+            if (!drain())
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds(poll_interval_ms));
+
+        // write what was logged before the destructor was called
+        drain();
+    }
+
+    /** Write all queued messages.
+    * @returns true if anything was written
+    */
+    bool drain()
+    {
+        Record record;
+        std::ostringstream message;
+        bool written = false;
+
+        while (queue.pop(record))
+        {
+            message.str(std::string());
+
+            // don't let a faulty formatter or sink kill the thread
+            try {
+                record.formatter(message);
+                sink->write(record.severity, message.str());
+            } catch(...) {}
+
+            record.formatter = nullptr;
+            written = true;
+        }
+
+        unsigned long lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost)
+        {
+            message.str(std::string());
+            message<<lost<<" log messages dropped, the log queue was full";
+
+            try {
+                sink->write(LogSeverity::warning, message.str());
+            } catch(...) {}
+
+            written = true;
+        }
+
+        if (written)
+        {
+            try {
+                sink->flush();
+            } catch(...) {}
+        }
+
+        return written;
+    }
+
+    // no copy construction allowed
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator= (const AsyncLogger&) = delete;
+};
+
+} // namespace clientnode
+} // namespace nuke_ms
+
+
+void StreamLogSink::write(LogSeverity severity, const std::string& message)
+{
+    std::ostream& stream =
+        severity == LogSeverity::error ? errorstream :
+        severity == LogSeverity::warning ? warnstream : infostream;
+
+    stream<<message<<'\n';
+}
+
+void StreamLogSink::flush()
+{
+    infostream.flush();
+    warnstream.flush();
+    errorstream.flush();
+}
+
+
+LoggingStreams::LoggingStreams(LogSeverity min_severity_)
+    : min_severity(min_severity_),
+    logger(std::make_shared<AsyncLogger>(std::make_shared<StreamLogSink>()))
+{}
+
+LoggingStreams::LoggingStreams(
+    std::shared_ptr<LogSink> sink,
+    LogSeverity min_severity_
+)
+    : min_severity(min_severity_),
+    logger(std::make_shared<AsyncLogger>(sink))
+{}
+
+void LoggingStreams::submit(LogSeverity severity, formatter_t&& formatter)
+{
+    logger->submit(severity, std::move(formatter));
+}
@@ -18,6 +18,7 @@
 */
 
 #include "clientnode/statemachine.hpp"
+#include "messagearena.hpp"
 
 using namespace nuke_ms;
 using namespace nuke_ms::clientnode;
@@ -25,12 +26,16 @@ using namespace boost::asio::ip;
 
 
 ClientnodeMachine::ClientnodeMachine(ClientNodeSignals&  _signals,
-	LoggingStreams logstreams_, boost::mutex& _machine_mutex
+	LoggingStreams logstreams_, boost::recursive_mutex& _machine_mutex
 )
     : signals(_signals), io_service(new boost::asio::io_service),
         socket(*io_service), resolver(*io_service),
-        logstreams(logstreams_), machine_mutex(_machine_mutex),
-        ReferenceCounter(std::bind(&ClientnodeMachine::on_returned, this))
+        logstreams(logstreams_), machine_mutex(_machine_mutex), connected(false),
+        user_id(0),
+        ReferenceCounter(std::bind(&ClientnodeMachine::on_returned, this)),
+        batch_queued_bytes(0), batch_timer_armed(false),
+        batch_timer_generation(0), batch_timer(*io_service),
+        write_scheduled(false), connection_id(0), next_stream_id(0)
 {}
 
 ClientnodeMachine::~ClientnodeMachine()
@@ -40,11 +45,9 @@ ClientnodeMachine::~ClientnodeMachine()
     catchThread(io_thread, thread_timeout);
 
     // wait for all handlers to retuirn
-    if (getRefCount() > 0)
-    {
-        boost::mutex::scoped_lock lk(reference_mutex);
+    boost::mutex::scoped_lock lk(returned_mutex);
+    while (getRefCount() > 0)
         returned_condition.wait(lk);
-    }
 }
 
 void ClientnodeMachine::startIOOperations()
@@ -77,8 +80,7 @@ void ClientnodeMachine::stopIOOperations()
 StateWaiting::StateWaiting(my_context ctx)
     : my_base(ctx)
 {
-    outermost_context().logstreams.infostream<<"Entering StateWaiting"<<
-		std::endl;
+    outermost_context().logstreams.info("Entering StateWaiting");
 
     // when we are waiting, we don't need the io_service object
     outermost_context().stopIOOperations();
@@ -105,9 +107,10 @@ boost::statechart::result StateWaiting::react(const EvtConnectRequest& evt)
     return transit< StateNegotiating >();
 }
 
-boost::statechart::result StateWaiting::react(const EvtSendMsg<NearUserMessage>& evt)
+boost::statechart::result StateWaiting::react(const EvtSendPacket& evt)
 {
     auto rprt = std::make_shared<SendReport>();
+    rprt->message_id = evt.msg_id;
     rprt->send_state = false;
     rprt->reason = SendReport::SR_SERVER_NOT_CONNECTED;
     rprt->reason_str = "Not Connected.";
@@ -122,8 +125,7 @@ boost::statechart::result StateWaiting::react(const EvtSendMsg<NearUserMessage>&
 StateNegotiating::StateNegotiating(my_context ctx)
     : my_base(ctx)
 {
-    outermost_context().logstreams.infostream<<"Entering StateNegotiating"<<
-		std::endl;
+    outermost_context().logstreams.info("Entering StateNegotiating");
 
     try {
         outermost_context().startIOOperations();
@@ -142,9 +144,10 @@ StateNegotiating::StateNegotiating(my_context ctx)
 
 }
 
-boost::statechart::result StateNegotiating::react(const EvtSendMsg<NearUserMessage>& evt)
+boost::statechart::result StateNegotiating::react(const EvtSendPacket& evt)
 {
     auto rprt = std::make_shared<SendReport>();
+    rprt->message_id = evt.msg_id;
     rprt->send_state = false;
     rprt->reason = SendReport::SR_SERVER_NOT_CONNECTED;
     rprt->reason_str = "Not yet Connected.";
@@ -211,7 +214,7 @@ void StateNegotiating::resolveHandler(
     std::shared_ptr<tcp::resolver::query> /* query */
 )
 {
-    cm.ref().logstreams.infostream<<"resolveHandler invoked."<<std::endl;
+    cm.ref().logstreams.debug("resolveHandler invoked.");
 
 
     // if there was an error, report it
@@ -231,23 +234,29 @@ void StateNegotiating::resolveHandler(
         else
             errmsg = "No hosts found.";
 
-        boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
+        boost::recursive_mutex::scoped_lock lk(cm.ref().machine_mutex);
         cm.ref().process_event(EvtConnectReport(false, errmsg));
 
         return;
     }
 
-    cm.ref().logstreams.infostream<<"Resolving finished. "
-		"The following records were found:\n";
-
-	// display all records for debugging purposes
-    tcp::resolver::iterator disp_it = endpoint_iterator;
-    while (disp_it != tcp::resolver::iterator())
+    // display all records for debugging purposes
+    if (cm.ref().logstreams.enabled(LogSeverity::debug))
     {
-        cm.ref().logstreams.infostream<<"\tHost: "<<
-            disp_it->endpoint().address().to_string()<<", Port: "<<
-            disp_it->endpoint().port()<<'\n';
-        ++disp_it;
+        std::string records;
+
+        tcp::resolver::iterator disp_it = endpoint_iterator;
+        while (disp_it != tcp::resolver::iterator())
+        {
+            records += "\n\tHost: " +
+                disp_it->endpoint().address().to_string() + ", Port: " +
+                std::to_string(disp_it->endpoint().port());
+            ++disp_it;
+        }
+
+        cm.ref().logstreams.debug(
+            "Resolving finished. The following records were found:",
+            std::move(records));
     }
 
     cm.ref().socket.async_connect(
@@ -270,30 +279,21 @@ void StateNegotiating::connectHandler(
 	tcp::resolver::iterator endpoint_iterator
 )
 {
-    cm.ref().logstreams.infostream<<"connectHandler invoked. (host "<<
-		endpoint_iterator->endpoint().address().to_string()<<")"<<std::endl;
+    cm.ref().logstreams.debug("connectHandler invoked. (host ",
+		endpoint_iterator->endpoint().address(), ")");
 
 	if(!error) // if there was no error, create a positive reply
     {
 
-        // create a receive buffer
-        byte_traits::byte_t* rcvbuf =
-            new byte_traits::byte_t[SegmentationLayerBase::header_length];
-
-        // start an asynchronous read to receive the header of the first packet
-        async_read(
-            cm.ref().socket,
-            boost::asio::buffer(rcvbuf, SegmentationLayerBase::header_length),
-            std::bind(
-                &StateConnected::receiveSegmentationHeaderHandler,
-                std::placeholders::_1,
-                std::placeholders::_2,
-                cm,
-                rcvbuf
-            )
+        // start receiving packets
+        StateConnected::startReceive(
+            cm,
+            std::make_shared<SegmentationStreamReader>(
+                SegmentationLayerBase::default_max_packetsize),
+            std::make_shared<FragmentAssembler>()
         );
 
-        boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
+        boost::recursive_mutex::scoped_lock lk(cm.ref().machine_mutex);
         cm.ref().process_event(EvtConnectReport(true,"Connection succeeded."));
     }
 	// if there was an error, but we still have records,
@@ -321,7 +321,7 @@ void StateNegotiating::connectHandler(
 
         byte_traits::native_string errmsg(error.message());
 
-        boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
+        boost::recursive_mutex::scoped_lock lk(cm.ref().machine_mutex);
         cm.ref().process_event(EvtConnectReport(false, errmsg));
     }
 
@@ -331,11 +331,85 @@ void StateNegotiating::connectHandler(
 
 
 
+/** Return the IDs of the packets the application is told about, in the order
+* they were sent. Packets of the client node itself are left out.
+*/
+static std::vector<NearUserMessage::msg_id_t> reportedIds(
+    const std::vector<ClientnodeMachine::BatchedPacket>& packets)
+{
+    std::vector<NearUserMessage::msg_id_t> ids;
+    ids.reserve(packets.size());
+
+    for (const auto& packet : packets)
+        if (packet.msg_id)
+            ids.push_back(packet.msg_id);
+
+    return ids;
+}
+
+
 StateConnected::StateConnected(my_context ctx)
     : my_base(ctx)
 {
-    outermost_context().logstreams.infostream<<"Entering StateConnected"<<
-		std::endl;
+    outermost_context().logstreams.info("Entering StateConnected");
+
+    ClientnodeMachine& cm = outermost_context();
+
+    // handlers of the last connection may never have run
+    {
+        boost::mutex::scoped_lock lk(cm.batch_mutex);
+        cm.batch_writing.reset();
+        cm.batch_timer_armed = false;
+        cm.write_scheduled = false;
+        ++cm.connection_id;
+    }
+
+    // From now on, messages bypass the state machine. ClientNode::setUserId
+    // looks at the flag after changing the user, so one of us announces
+    // the new user.
+    cm.connected.store(true);
+
+    announceUser(cm);
+}
+
+StateConnected::~StateConnected()
+{
+    ClientnodeMachine& cm = outermost_context();
+    std::vector<ClientnodeMachine::BatchedPacket> lost;
+
+    cm.connected.store(false, std::memory_order_release);
+
+    {
+        boost::mutex::scoped_lock lk(cm.batch_mutex);
+
+        boost::system::error_code dontcare;
+        cm.batch_timer.cancel(dontcare);
+
+        // The write of the current batch is aborted when the socket is
+        // closed. Its handler may never run, so the batch is reported here.
+        if (cm.batch_writing)
+        {
+            lost.swap(cm.batch_writing->packets);
+            cm.batch_writing.reset();
+        }
+
+        lost.insert(lost.end(), cm.batch_queue.begin(), cm.batch_queue.end());
+        cm.batch_queue.clear();
+        cm.batch_queued_bytes = 0;
+    }
+
+    std::vector<NearUserMessage::msg_id_t> lost_ids = reportedIds(lost);
+    if (lost_ids.empty())
+        return;
+
+    auto rprt = std::make_shared<SendReport>();
+    rprt->message_id = lost_ids.back();
+    rprt->message_ids = std::move(lost_ids);
+    rprt->send_state = false;
+    rprt->reason = SendReport::SR_SERVER_NOT_CONNECTED;
+    rprt->reason_str = "Disconnected before the messages were sent.";
+
+    cm.signals.sendReport(rprt);
 }
 
 
@@ -351,31 +425,133 @@ boost::statechart::result StateConnected::react(const EvtDisconnectRequest&)
 }
 
 
-boost::statechart::result StateConnected::react(const EvtSendMsg<NearUserMessage>& evt)
+boost::statechart::result StateConnected::react(const EvtSendPacket& evt)
 {
-    // create segmentation layer from the data to be sent
-    SegmentationLayer<NearUserMessage> segm_layer{std::move(*evt._data)};
+    // only reached if the message was sent while the connection was being
+    // established
+    sendPacket(outermost_context(), evt);
 
-    // create buffer, fill it with the serialized message
-    auto data = std::make_shared<byte_traits::byte_sequence>(
-        segm_layer.size()
-    );
+    return discard_event();
+}
 
-    segm_layer.fillSerialized(data->begin());
 
-    async_write(
-        context<ClientnodeMachine>().socket,
-        boost::asio::buffer(*data),
-        std::bind(
-            &StateConnected::writeHandler,
-            std::placeholders::_1,
-            std::placeholders::_2,
-            ClientnodeMachine::CountedReference(outermost_context()),
-            data
-        )
-    );
+void StateConnected::sendPacket(ClientnodeMachine& cm, const EvtSendPacket& evt)
+{
+    // put the headers in front of the message, large messages are split
+    // into fragments
+    SegmentationLayerBase::segmentInPlace(*evt.buffer, evt.payload_size,
+        SegmentationLayerBase::default_max_packetsize,
+        cm.nextStreamId());
 
-    return discard_event();
+    {
+        boost::mutex::scoped_lock lk(cm.batch_mutex);
+
+        if (cm.connected.load(std::memory_order_relaxed))
+        {
+            cm.batch_queue.push_back(ClientnodeMachine::BatchedPacket{
+                evt.buffer, evt.packet_size, evt.msg_id});
+            cm.batch_queued_bytes += evt.packet_size;
+
+            // A running write picks up the packet when it completes, and an
+            // armed timer writes it unless there is enough to write now.
+            if (!cm.batch_writing && (!cm.batch_timer_armed
+                || cm.batch_queued_bytes >= cm.batch_options.max_bytes))
+                scheduleWrite(cm);
+
+            return;
+        }
+    }
+
+    // the connection was closed after the caller checked
+    if (!evt.msg_id)
+        return;
+
+    auto rprt = std::make_shared<SendReport>();
+    rprt->message_id = evt.msg_id;
+    rprt->send_state = false;
+    rprt->reason = SendReport::SR_SERVER_NOT_CONNECTED;
+    rprt->reason_str = "Not Connected.";
+
+    cm.signals.sendReport(rprt);
+}
+
+void StateConnected::announceUser(ClientnodeMachine& cm)
+{
+    UniqueUserID user_id(cm.user_id.load());
+    if (user_id == UniqueUserID::user_id_none)
+        return;
+
+    std::size_t payload_size = NearUserMessage::header_length;
+    std::size_t packet_size = SegmentationLayerBase::segmentedSize(
+        payload_size, SegmentationLayerBase::default_max_packetsize);
+
+    // the ID 0 keeps the packet out of the send reports
+    EvtSendPacket evt{BufferPool::instance()->acquire(packet_size),
+        packet_size, payload_size, 0};
+
+    NearUserMessage::serialize(
+        evt.buffer->begin() + (packet_size - payload_size),
+        0, UniqueUserID::user_id_none, user_id, byte_traits::msg_string());
+
+    sendPacket(cm, evt);
+}
+
+void StateConnected::scheduleWrite(ClientnodeMachine& cm)
+{
+    if (cm.write_scheduled)
+        return;
+
+    cm.write_scheduled = true;
+
+    // the socket must only be used from within the I/O thread
+    cm.post(std::bind(
+        &StateConnected::writeQueued,
+        ClientnodeMachine::CountedReference(cm),
+        cm.connection_id
+    ));
+}
+
+void StateConnected::writeQueued(
+    ClientnodeMachine::CountedReference cm,
+    unsigned connection_id
+)
+{
+    ClientnodeMachine& machine = cm.ref();
+    boost::mutex::scoped_lock lk(machine.batch_mutex);
+
+    // the connection was closed, its packets were reported already
+    if (connection_id != machine.connection_id)
+        return;
+
+    machine.write_scheduled = false;
+
+    // a running write picks up the packets when it completes
+    if (machine.batch_writing || machine.batch_queue.empty())
+        return;
+
+    // without batching, max_bytes is zero and the packets are written now
+    if (machine.batch_queued_bytes >= machine.batch_options.max_bytes)
+    {
+        if (machine.batch_timer_armed)
+        {
+            boost::system::error_code dontcare;
+            machine.batch_timer.cancel(dontcare);
+            machine.batch_timer_armed = false;
+        }
+
+        startBatchWrite(cm);
+    }
+    else if (!machine.batch_timer_armed)
+    {
+        machine.batch_timer_armed = true;
+        machine.batch_timer.expires_after(machine.batch_options.max_delay);
+        machine.batch_timer.async_wait(std::bind(
+            &StateConnected::batchTimerHandler,
+            std::placeholders::_1,
+            cm,
+            ++machine.batch_timer_generation
+        ));
+    }
 }
 
 
@@ -392,37 +568,29 @@ boost::statechart::result StateConnected::react(const EvtDisconnected& evt)
 }
 
 
-boost::statechart::result
-StateConnected::react(const EvtRcvdMessage<SerializedData>& evt)
+void StateConnected::deliverMessage(ClientnodeMachine& cm, SerializedData&& data)
 {
-    // whatever it is, we need a SerializedData object from it
-    SerializedData data{std::move(evt._data->_inner_layer)};
-
-
     try {
         // check out the layer identifier if it's a string, dispatch it.
         // If not, discard
-        if (*data.begin() ==
+        if (data.size() && *data.begin() ==
             static_cast<byte_traits::byte_t>(NearUserMessage::LAYER_ID))
         {
-            auto usermsg = std::make_shared<NearUserMessage>(data);
-            context<ClientnodeMachine>().signals.rcvMessage(usermsg);
+            // the message and its reference count share one pooled block
+            auto usermsg = MessageArena().makeShared<NearUserMessage>(data);
+            cm.signals.rcvMessage(usermsg);
         }
         else
 		{
-            outermost_context().logstreams.warnstream<<
-				"Received packet with unknown layer identifier! Discarding."<<
-				std::endl;
+            cm.logstreams.warning(
+				"Received packet with unknown layer identifier! Discarding.");
 		}
     }
     catch(const MsgLayerError& e)
     {
-        outermost_context().logstreams.errorstream<<
-			"Reiceived packet but failed to create Message object: "<<e.what()<<
-			std::endl;
+        cm.logstreams.error(
+			"Reiceived packet but failed to create Message object: ", e.what());
     }
-
-    return discard_event();
 }
 
 
@@ -440,154 +608,226 @@ boost::statechart::result StateConnected::react(const EvtConnectRequest&)
 
 
 
-void StateConnected::writeHandler(
-    const boost::system::error_code& error,
-    std::size_t bytes_transferred,
-    ClientnodeMachine::CountedReference cm,
-    std::shared_ptr<byte_traits::byte_sequence> data
-)
+void StateConnected::startBatchWrite(ClientnodeMachine::CountedReference cm)
 {
-    cm.ref().logstreams.infostream<<"Sending message finished"<<std::endl;
+    ClientnodeMachine& machine = cm.ref();
+
+    auto batch = std::make_shared<ClientnodeMachine::BatchWrite>();
+    batch->packets.swap(machine.batch_queue);
+    batch->report_each = !machine.batch_options.max_bytes;
+    machine.batch_queued_bytes = 0;
+
+    // gather the packets into one write
+    batch->buffers.reserve(batch->packets.size());
+    for (const auto& packet : batch->packets)
+        batch->buffers.push_back(
+            boost::asio::buffer(*packet.buffer, packet.size));
+
+    machine.batch_writing = batch;
 
+    // the handler keeps the packets alive until the write completed
+    async_write(
+        machine.socket,
+        batch->buffers,
+        std::bind(
+            &StateConnected::batchWriteHandler,
+            std::placeholders::_1,
+            std::placeholders::_2,
+            cm,
+            batch
+        )
+    );
+}
 
+/** Fill in the outcome of a write */
+static void setSendState(SendReport& rprt,
+    const boost::system::error_code& error)
+{
     if (!error)
     {
-        auto rprt = std::make_shared<SendReport>();
-        rprt->send_state = true;
-        rprt->reason = SendReport::SR_SEND_OK;
-
-        cm.ref().signals.sendReport(rprt);
+        rprt.send_state = true;
+        rprt.reason = SendReport::SR_SEND_OK;
     }
     else
     {
-        byte_traits::native_string errmsg(error.message());
-
-        auto rprt = std::make_shared<SendReport>();
-        rprt->send_state = false;
-        rprt->reason = SendReport::SR_CONNECTION_ERROR;
-        rprt->reason_str = errmsg;
-
-        cm.ref().signals.sendReport(rprt);
-
-        boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
-        cm.ref().process_event(EvtDisconnected(errmsg));
-
+        rprt.send_state = false;
+        rprt.reason = SendReport::SR_CONNECTION_ERROR;
+        rprt.reason_str = error.message();
     }
 }
 
-
-void StateConnected::receiveSegmentationHeaderHandler(
+void StateConnected::batchWriteHandler(
     const boost::system::error_code& error,
-    std::size_t bytes_transferred,
+    std::size_t /* bytes_transferred */,
     ClientnodeMachine::CountedReference cm,
-    byte_traits::byte_t rcvbuf[SegmentationLayerBase::header_length]
+    std::shared_ptr<ClientnodeMachine::BatchWrite> batch
 )
 {
-    cm.ref().logstreams.infostream<<"Reveive (header) handler invoked"<<std::endl;
+    ClientnodeMachine& machine = cm.ref();
 
-    // if there was an error,
-    // tear down the connection by posting a disconnection event
-    if (error || bytes_transferred != SegmentationLayerBase::header_length)
     {
-		// if the operation was aborted, the state machine might not be alive,
-		// so we STFU and return
-		if (error == boost::asio::error::operation_aborted)
-			return;
+        boost::mutex::scoped_lock lk(machine.batch_mutex);
 
-        byte_traits::native_string errmsg(error.message());
+        // the connection is gone, the batch was reported already
+        if (machine.batch_writing != batch)
+            return;
 
-        boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
-        cm.ref().process_event(EvtDisconnected(errmsg));
+        machine.batch_writing.reset();
+
+        // Packets queued in the meantime are written right away, unless the
+        // timer is still waiting and there is not enough to write.
+        if (!error && !machine.batch_queue.empty()
+            && (!machine.batch_timer_armed || machine.batch_queued_bytes
+                >= machine.batch_options.max_bytes))
+            startBatchWrite(cm);
     }
-    else // if no error occured, try to decode the header
+
+    machine.logstreams.debug("Sending finished");
+
+    if (batch->report_each)
     {
-        try {
-            // decode and verify the header of the message
-            SegmentationLayerBase::HeaderType header_data
-                = SegmentationLayerBase::decodeHeader(rcvbuf);
-
-/// @todo Magic number, set to something proper or make configurable
-constexpr byte_traits::uint2b_t MAX_PACKETSIZE = 0x8FFF;
-
-            if (header_data.packetsize > MAX_PACKETSIZE)
-                throw MsgLayerError("Oversized packet.");
-
-            auto body_buf = std::make_shared<byte_traits::byte_sequence>(
-                header_data.packetsize-SegmentationLayerBase::header_length);
-
-            // start an asynchronous receive for the body
-            async_read(
-                cm.ref().socket,
-                boost::asio::buffer(*body_buf),
-                std::bind(
-                    &StateConnected::receiveSegmentationBodyHandler,
-                    std::placeholders::_1 /* boost::asio::placeholders::error */,
-                    std::placeholders::_2 /* boost::asio::placeholders::bytes_transferred */ ,
-                    cm,
-                    body_buf
-                )
-            );
-        }
-        // on failure, report back to application
-        catch (const std::exception& e)
+        // a report for every sent message, take it from a pooled block
+        for (const auto& packet : batch->packets)
         {
-            boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
-            cm.ref().process_event(EvtDisconnected(e.what()));
+            if (!packet.msg_id)
+                continue;
+
+            auto rprt = MessageArena().makeShared<SendReport>();
+            rprt->message_id = packet.msg_id;
+            setSendState(*rprt, error);
+            machine.signals.sendReport(rprt);
         }
-        catch(...)
+    }
+    else
+    {
+        // one report for the whole batch
+        std::vector<NearUserMessage::msg_id_t> ids =
+            reportedIds(batch->packets);
+
+        if (!ids.empty())
         {
-            boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
-            cm.ref().process_event(EvtDisconnected("Unknown Error"));
+            auto rprt = MessageArena().makeShared<SendReport>();
+            rprt->message_id = ids.back();
+            rprt->message_ids = std::move(ids);
+            setSendState(*rprt, error);
+            machine.signals.sendReport(rprt);
         }
     }
 
-    delete[] rcvbuf;
+    if (error && error != boost::asio::error::operation_aborted)
+    {
+        boost::recursive_mutex::scoped_lock lk(machine.machine_mutex);
+        machine.process_event(EvtDisconnected(error.message()));
+    }
 }
 
-void StateConnected::receiveSegmentationBodyHandler(
+void StateConnected::batchTimerHandler(
+    const boost::system::error_code& error,
+    ClientnodeMachine::CountedReference cm,
+    unsigned generation
+)
+{
+    if (error == boost::asio::error::operation_aborted)
+        return;
+
+    ClientnodeMachine& machine = cm.ref();
+    boost::mutex::scoped_lock lk(machine.batch_mutex);
+
+    // The timer fired just before it was cancelled. The packets were written
+    // already, and the timer may have been armed again since.
+    if (!machine.batch_timer_armed
+        || generation != machine.batch_timer_generation)
+        return;
+
+    machine.batch_timer_armed = false;
+
+    // a running batch write picks up the packets when it completes
+    if (!machine.batch_writing && !machine.batch_queue.empty())
+        startBatchWrite(cm);
+}
+
+
+void StateConnected::startReceive(
+    ClientnodeMachine::CountedReference cm,
+    std::shared_ptr<SegmentationStreamReader> reader,
+    std::shared_ptr<FragmentAssembler> assembler
+)
+{
+    // read whatever is available, the packets are split up afterwards
+    cm.ref().socket.async_read_some(
+        reader->prepare(),
+        std::bind(
+            &StateConnected::receiveHandler,
+            std::placeholders::_1 /* boost::asio::placeholders::error */,
+            std::placeholders::_2 /* boost::asio::placeholders::bytes_transferred */ ,
+            cm,
+            reader,
+            assembler
+        )
+    );
+}
+
+void StateConnected::receiveHandler(
     const boost::system::error_code& error,
     std::size_t bytes_transferred,
     ClientnodeMachine::CountedReference cm,
-    std::shared_ptr<byte_traits::byte_sequence> rcvbuf
+    std::shared_ptr<SegmentationStreamReader> reader,
+    std::shared_ptr<FragmentAssembler> assembler
 )
 {
+    cm.ref().logstreams.debug("Reveive handler invoked");
+
     // if there was an error,
     // tear down the connection by posting a disconnection event
     if (error)
     {
-        boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
-        cm.ref().process_event(EvtDisconnected(error.message()));
+		// if the operation was aborted, the state machine might not be alive,
+		// so we STFU and return
+		if (error == boost::asio::error::operation_aborted)
+			return;
+
+        byte_traits::native_string errmsg(error.message());
+
+        boost::recursive_mutex::scoped_lock lk(cm.ref().machine_mutex);
+        cm.ref().process_event(EvtDisconnected(errmsg));
+        return;
     }
-    else // if no error occured, report the received message to the application
-    {
-        SegmentationLayer<SerializedData> segmlayer{
-            {rcvbuf, rcvbuf->begin(), rcvbuf->size()}
-        };
 
-        {
-            boost::mutex::scoped_lock lk(cm.ref().machine_mutex);
-            cm.ref().process_event(
-                EvtRcvdMessage<SerializedData>{std::move(segmlayer)}
-            );
-        }
-        // start a new receive for the next message
+    // the connection was closed while the data was received
+    if (!cm.ref().connected.load(std::memory_order_acquire))
+        return;
 
-        // create a receive buffer
-        byte_traits::byte_t* rcvbuf =
-            new byte_traits::byte_t[SegmentationLayerBase::header_length];
+    reader->commit(bytes_transferred);
 
-        // start an asynchronous read to receive the header of the first packet
-        async_read(
-            cm.ref().socket,
-            boost::asio::buffer(rcvbuf, SegmentationLayerBase::header_length),
-            std::bind(
-                &StateConnected::receiveSegmentationHeaderHandler,
-                std::placeholders::_1,
-                std::placeholders::_2,
-                cm,
-                rcvbuf
-            )
-        );
+    try {
+        SerializedData packet({}, {}, 0), message({}, {}, 0);
+
+        // messages are handed to the application directly, the state
+        // machine is not involved
+        while (reader->nextPacket(packet))
+        {
+            // fragments are collected until their message is complete
+            if (!assembler->addPacket(packet, message))
+                continue;
+
+            deliverMessage(cm.ref(), std::move(message));
+        }
+    }
+    // on failure, report back to application
+    catch (const std::exception& e)
+    {
+        boost::recursive_mutex::scoped_lock lk(cm.ref().machine_mutex);
+        cm.ref().process_event(EvtDisconnected(e.what()));
+        return;
+    }
+    catch(...)
+    {
+        boost::recursive_mutex::scoped_lock lk(cm.ref().machine_mutex);
+        cm.ref().process_event(EvtDisconnected("Unknown Error"));
+        return;
     }
+
+    // start a new receive for the next messages
+    startReceive(cm, reader, assembler);
 }
 
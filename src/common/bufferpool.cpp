@@ -0,0 +1,171 @@
+// bufferpool.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <new>
+
+#include "bufferpool.hpp"
+
+using namespace nuke_ms;
+
+
+BufferPool::BufferPool(std::size_t max_free_buffers_)
+    : max_free_buffers(max_free_buffers_), acquired_count(0),
+    allocated_count(0)
+{
+    // reserve all memory for the free lists now, so returning buffers and
+    // nodes to the pool never allocates and never throws
+    for (unsigned i = 0; i < class_count; ++i)
+        free_buffers[i].reserve(max_free_buffers);
+
+    free_nodes.reserve(max_free_buffers * class_count);
+}
+
+BufferPool::~BufferPool()
+{
+    for (unsigned i = 0; i < class_count; ++i)
+        for (auto buffer : free_buffers[i])
+            delete buffer;
+
+    for (auto node : free_nodes)
+        ::operator delete(node);
+}
+
+std::shared_ptr<BufferPool> BufferPool::instance()
+{
+    // buffers that are still alive during static destruction hold a
+    // reference to the pool, so it will outlive them
+    static std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+
+    return pool;
+}
+
+unsigned BufferPool::sizeClass(std::size_t size)
+{
+    unsigned size_class = 0;
+    std::size_t class_size = min_class_size;
+
+    while (class_size < size && size_class < class_count)
+    {
+        class_size <<= 1;
+        ++size_class;
+    }
+
+    return size_class;
+}
+
+BufferPool::buffer_ptr_t BufferPool::acquire(std::size_t size)
+{
+    unsigned size_class = sizeClass(size);
+
+    acquired_count.fetch_add(1, std::memory_order_relaxed);
+
+    // buffers that are too big are not pooled
+    if (size_class == class_count)
+    {
+        allocated_count.fetch_add(1, std::memory_order_relaxed);
+        return std::make_shared<byte_traits::byte_sequence>(size);
+    }
+
+    byte_traits::byte_sequence* buffer = nullptr;
+
+    {
+        boost::mutex::scoped_lock lock(pool_mutex);
+
+        if (!free_buffers[size_class].empty())
+        {
+            buffer = free_buffers[size_class].back();
+            free_buffers[size_class].pop_back();
+        }
+    }
+
+    // allocate a new buffer if there was none in the pool
+    if (!buffer)
+    {
+        buffer = new byte_traits::byte_sequence(min_class_size << size_class);
+        allocated_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // if this throws, the shared_ptr constructor puts the buffer back
+    return buffer_ptr_t(
+        buffer,
+        Recycler{this, size_class},
+        NodeAllocator<byte_traits::byte_sequence>(shared_from_this())
+    );
+}
+
+BufferPool::Statistics BufferPool::statistics() const
+{
+    Statistics stats;
+    stats.acquired = acquired_count.load(std::memory_order_relaxed);
+    stats.allocated = allocated_count.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+void BufferPool::release(
+    byte_traits::byte_sequence* buffer,
+    unsigned size_class
+)
+{
+    {
+        boost::mutex::scoped_lock lock(pool_mutex);
+
+        if (free_buffers[size_class].size() < max_free_buffers)
+        {
+            free_buffers[size_class].push_back(buffer);
+            return;
+        }
+    }
+
+    delete buffer;
+}
+
+void* BufferPool::allocateNode(std::size_t size)
+{
+    if (size <= node_size)
+    {
+        boost::mutex::scoped_lock lock(pool_mutex);
+
+        if (!free_nodes.empty())
+        {
+            void* node = free_nodes.back();
+            free_nodes.pop_back();
+            return node;
+        }
+    }
+
+    return ::operator new(size <= node_size ? node_size : size);
+}
+
+void BufferPool::deallocateNode(void* node, std::size_t size)
+{
+    if (size <= node_size)
+    {
+        boost::mutex::scoped_lock lock(pool_mutex);
+
+        // keep as many nodes as there can be unused buffers
+        if (free_nodes.size() < max_free_buffers * class_count)
+        {
+            free_nodes.push_back(node);
+            return;
+        }
+    }
+
+    ::operator delete(node);
+}
@@ -0,0 +1,106 @@
+// fragmentassembler.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "fragmentassembler.hpp"
+
+using namespace nuke_ms;
+
+
+FragmentAssembler::FragmentAssembler(
+    std::size_t max_message_size,
+    std::size_t max_streams
+)
+    : _max_message_size(max_message_size), _max_streams(max_streams),
+    _fragment_count(0)
+{}
+
+bool FragmentAssembler::addPacket(
+    const SerializedData& packet,
+    SerializedData& message
+)
+{
+    SegmentationLayerBase::HeaderType header =
+        SegmentationLayerBase::decodeHeader(packet.begin());
+
+    SerializedData::const_data_it payload_begin =
+        packet.begin() + header.headerLength();
+    std::size_t payload_size = packet.size() - header.headerLength();
+
+    // complete packets reference the buffer they were received into
+    if (!header.isFragment())
+    {
+        message = SerializedData(
+            packet.getOwnership(), payload_begin, payload_size);
+        return true;
+    }
+
+    auto stream = findStream(header.stream_id);
+
+    if (!(header.flags & SegmentationLayerBase::FLAG_CONTINUED))
+    {
+        // the first fragment starts the message over
+        if (stream == _streams.end())
+        {
+            if (_streams.size() >= _max_streams)
+            {
+                stream = std::min_element(_streams.begin(), _streams.end(),
+                    [](const Stream& a, const Stream& b)
+                    { return a.last_used < b.last_used; });
+            }
+            else
+                stream = _streams.insert(_streams.end(), Stream());
+
+            stream->stream_id = header.stream_id;
+        }
+
+        stream->data = std::make_shared<byte_traits::byte_sequence>();
+    }
+    // the beginning of the message was missed or discarded
+    else if (stream == _streams.end())
+        return false;
+
+    byte_traits::byte_sequence& data = *stream->data;
+
+    if (data.size() + payload_size > _max_message_size)
+    {
+        _streams.erase(stream);
+        throw OversizedPacketError();
+    }
+
+    data.insert(data.end(), payload_begin, payload_begin + payload_size);
+    stream->last_used = ++_fragment_count;
+
+    if (header.flags & SegmentationLayerBase::FLAG_MORE)
+        return false;
+
+    message = SerializedData(stream->data, data.begin(), data.size());
+    _streams.erase(stream);
+
+    return true;
+}
+
+std::vector<FragmentAssembler::Stream>::iterator
+FragmentAssembler::findStream(SegmentationLayerBase::stream_id_t stream_id)
+{
+    return std::find_if(_streams.begin(), _streams.end(),
+        [stream_id](const Stream& stream)
+        { return stream.stream_id == stream_id; });
+}
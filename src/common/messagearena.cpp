@@ -0,0 +1,77 @@
+// messagearena.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstddef>
+#include <functional>
+#include <new>
+
+#include "messagearena.hpp"
+
+using namespace nuke_ms;
+
+
+// The first bytes of a block hold the number of bytes that are allocated,
+// including this counter. The memory of a vector is allocated with new, so
+// it is suitably aligned for the counter.
+namespace
+{
+
+std::size_t& usedBytes(byte_traits::byte_sequence& block)
+{
+    return *reinterpret_cast<std::size_t*>(block.data());
+}
+
+constexpr std::size_t counter_size = alignof(std::max_align_t);
+
+} // anonymous namespace
+
+
+MessageArena::MessageArena(std::size_t capacity)
+    : _block(BufferPool::instance()->acquire(capacity + counter_size))
+{
+    usedBytes(*_block) = counter_size;
+}
+
+void* detail::arenaAllocate(
+    byte_traits::byte_sequence& block,
+    std::size_t size,
+    std::size_t alignment
+)
+{
+    std::size_t& used = usedBytes(block);
+
+    std::size_t begin = (used + alignment - 1) & ~(alignment - 1);
+    if (alignment <= counter_size && begin + size <= block.size())
+    {
+        used = begin + size;
+        return block.data() + begin;
+    }
+
+    return ::operator new(size);
+}
+
+void detail::arenaDeallocate(byte_traits::byte_sequence& block, void* p)
+{
+    const byte_traits::byte_t* byte_p =
+        static_cast<const byte_traits::byte_t*>(p);
+
+    std::less<const byte_traits::byte_t*> less;
+    if (less(byte_p, block.data()) || !less(byte_p, block.data() + block.size()))
+        ::operator delete(p);
+}
@@ -18,6 +18,7 @@
 */
 
 #include <algorithm>
+#include <cstring>
 
 #include "bytes.hpp"
 #include "msglayer.hpp"
@@ -36,12 +37,117 @@ template class SegmentationLayer<StringwrapLayer>;
 template
 byte_traits::byte_sequence::iterator StringwrapLayer::fillSerialized(
     byte_traits::byte_sequence::iterator it) const;
+template std::size_t SegmentationLayerBase::peekHeaderLength(
+    byte_traits::byte_sequence::iterator headerbuf);
 template SegmentationLayerBase::HeaderType SegmentationLayerBase::decodeHeader(
     byte_traits::byte_sequence::iterator headerbuf);
 
 } // namespace nuke_ms
 
 
+/////////////////////////// SegmentationLayerBase //////////////////////////////
+
+
+SegmentationLayerBase::HeaderType
+SegmentationLayerBase::makeHeader(std::size_t payload_size)
+{
+    HeaderType header;
+    header.flags = 0;
+    header.stream_id = 0;
+
+    if (payload_size + v0_header_length <=
+        std::numeric_limits<byte_traits::uint2b_t>::max())
+    {
+        header.version = 0;
+        header.packetsize = payload_size + v0_header_length;
+    }
+    else
+    {
+        if (payload_size + v1_header_length >
+            std::numeric_limits<byte_traits::uint4b_t>::max())
+            throw OversizedPacketError();
+
+        header.version = 1;
+        header.packetsize = payload_size + v1_header_length;
+    }
+
+    return header;
+}
+
+std::size_t SegmentationLayerBase::segmentedSize(
+    std::size_t payload_size,
+    std::size_t max_packetsize
+)
+{
+    if (max_packetsize <= v1_header_length)
+        throw std::invalid_argument("Maximum packet size is too small");
+
+    std::size_t packetsize = makeHeader(payload_size).packetsize;
+    if (packetsize <= max_packetsize)
+        return packetsize;
+
+    // every fragment carries as much of the payload as fits
+    std::size_t fragment_payload = max_packetsize - v1_header_length;
+    std::size_t fragment_count =
+        (payload_size + fragment_payload - 1) / fragment_payload;
+
+    return payload_size + fragment_count * v1_header_length;
+}
+
+void SegmentationLayerBase::segmentInPlace(
+    byte_traits::byte_sequence& buffer,
+    std::size_t payload_size,
+    std::size_t max_packetsize,
+    stream_id_t stream_id
+)
+{
+    std::size_t total_size = segmentedSize(payload_size, max_packetsize);
+
+    // a single packet, the payload is already in place
+    HeaderType header = makeHeader(payload_size);
+    if (header.packetsize <= max_packetsize)
+    {
+        encodeHeader(buffer.begin(), header);
+        return;
+    }
+
+    if (stream_id == 0)
+        throw std::invalid_argument("Fragments need a stream identifier");
+
+    std::size_t fragment_payload = max_packetsize - v1_header_length;
+
+    // Every fragment is moved towards the front. The headers in front of a
+    // fragment end before its old position, so nothing is overwritten that
+    // was not moved yet.
+    std::size_t src = total_size - payload_size, dst = 0;
+    std::size_t remaining = payload_size;
+    byte_traits::byte_t flags = 0;
+
+    while (remaining)
+    {
+        std::size_t length = std::min(remaining, fragment_payload);
+        remaining -= length;
+
+        if (remaining)
+            flags |= FLAG_MORE;
+        else
+            flags &= ~FLAG_MORE;
+
+        header.version = 1;
+        header.flags = flags;
+        header.packetsize = length + v1_header_length;
+        header.stream_id = stream_id;
+
+        encodeHeader(buffer.begin() + dst, header);
+        std::memmove(&buffer[dst + v1_header_length], &buffer[src], length);
+
+        dst += v1_header_length + length;
+        src += length;
+        flags |= FLAG_CONTINUED;
+    }
+}
+
+
 ////////////////////////////// StringwrapLayer /////////////////////////////////
 
 
@@ -74,18 +180,8 @@ StringwrapLayer::StringwrapLayer(const SerializedData& msg)
     _message_string.resize((datasize)/
         sizeof(byte_traits::msg_string::value_type));
 
-    // iterator to the message_string
-    byte_traits::msg_string::iterator out_iter = _message_string.begin();
-
-    std::remove_reference<decltype(*out_iter)>::type tmpval;
-
-    // iterate through all bytes in the sequence
-    for ( auto it = data_it; it < data_it + datasize; )
-    {
-        // read bytes into a character, convert byte endianness
-        it = readbytes(&tmpval, it);
-        *out_iter++ = to_hostbo(tmpval);
-    }
-
+    // read all characters, convert byte endianness
+    if (!_message_string.empty())
+        readsequence(&_message_string[0], _message_string.size(), data_it);
 }
 
@@ -28,10 +28,14 @@ namespace nuke_ms {
 // explicit class template instantions
 template class BasicMessageLayer<NearUserMessage>;
 template class SegmentationLayer<NearUserMessage>;
+template class BasicMessageLayer<ChannelMessage>;
+template class SegmentationLayer<ChannelMessage>;
 
 // template function specializations
 template byte_traits::byte_sequence::iterator
 NearUserMessage::fillSerialized(byte_traits::byte_sequence::iterator it) const;
+template byte_traits::byte_sequence::iterator
+ChannelMessage::fillSerialized(byte_traits::byte_sequence::iterator it) const;
 
 } // namespace nuke_ms
 
@@ -43,22 +47,36 @@ NearUserMessage::NearUserMessage(const SerializedData& data)
     if (data.size() < header_length)
         throw UndersizedPacketError();
 
+    // layer identifier, message id, recipient and sender
+    byte_traits::byte_t layer_id;
+    in_it = HeaderLayoutType::decode(
+        in_it, layer_id, _msg_id, _recipient.id, _sender.id);
+
     // if first byte isn't the correct layer identifier that's a wrong packet
-    if (*in_it++ != LAYER_ID) throw InvalidHeaderError();
+    if (layer_id != LAYER_ID) throw InvalidHeaderError();
+
+    // the rest is the message string
+    _stringwrap = StringwrapLayer(
+        SerializedData(data.getOwnership(), in_it, data.size() - header_length)
+    );
+}
 
-    // get msg id
-    in_it = readbytes<byte_traits::uint4b_t>(&_msg_id, in_it);
 
-    // reverse msg id correctly
-    _msg_id = to_hostbo(_msg_id);
 
-    // recipient
-    _recipient = UniqueUserID(in_it);
-    in_it += UniqueUserID::id_length;
+ChannelMessage::ChannelMessage(const SerializedData& data)
+{
+    if (!peekHeader(data, _operation, _channel))
+    {
+        // tell apart the reasons why the header was refused
+        if (data.size() < header_length)
+            throw UndersizedPacketError();
+
+        throw InvalidHeaderError();
+    }
 
-    // sender
-    _sender = UniqueUserID(in_it);
-    in_it += UniqueUserID::id_length;
+    byte_traits::byte_t layer_id, operation;
+    auto in_it = HeaderLayoutType::decode(
+        data.begin(), layer_id, operation, _msg_id, _channel, _sender.id);
 
     // the rest is the message string
     _stringwrap = StringwrapLayer(
@@ -66,3 +84,24 @@ NearUserMessage::NearUserMessage(const SerializedData& data)
     );
 }
 
+bool ChannelMessage::peekHeader(
+    const SerializedData& data,
+    operation_t& operation,
+    channel_id_t& channel
+)
+{
+    if (data.size() < header_length)
+        return false;
+
+    byte_traits::byte_t layer_id, op;
+    msg_id_t msg_id;
+    decltype(UniqueUserID::id) sender;
+    HeaderLayoutType::decode(data.begin(), layer_id, op, msg_id, channel, sender);
+
+    if (layer_id != LAYER_ID
+        || (op != OP_SUBSCRIBE && op != OP_UNSUBSCRIBE && op != OP_PUBLISH))
+        return false;
+
+    operation = static_cast<operation_t>(op);
+    return true;
+}
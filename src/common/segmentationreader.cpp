@@ -0,0 +1,132 @@
+// segmentationreader.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "segmentationreader.hpp"
+
+using namespace nuke_ms;
+
+
+SegmentationStreamReader::SegmentationStreamReader(
+    std::size_t max_packetsize,
+    std::size_t chunk_size
+)
+    : _max_packetsize(max_packetsize), _chunk_size(chunk_size),
+    _begin(0), _end(0)
+{}
+
+boost::asio::mutable_buffers_1 SegmentationStreamReader::prepare()
+{
+    makeRoom();
+
+    return boost::asio::buffer(
+        &(*_buffer)[_end], _buffer->size() - _end
+    );
+}
+
+void SegmentationStreamReader::commit(std::size_t bytes_transferred)
+{
+    _end += bytes_transferred;
+}
+
+bool SegmentationStreamReader::nextPacket(SerializedData& packet)
+{
+    std::size_t available = _end - _begin;
+
+    if (available < SegmentationLayerBase::min_header_length)
+        return false;
+
+    auto packet_begin = _buffer->begin() + _begin;
+
+    if (available < SegmentationLayerBase::peekHeaderLength(packet_begin))
+        return false;
+
+    SegmentationLayerBase::HeaderType header =
+        SegmentationLayerBase::decodeHeader(packet_begin);
+
+    if (header.packetsize > _max_packetsize)
+        throw OversizedPacketError();
+
+    if (available < header.packetsize)
+        return false;
+
+    packet = SerializedData(_buffer, packet_begin, header.packetsize);
+    _begin += header.packetsize;
+
+    return true;
+}
+
+void SegmentationStreamReader::makeRoom()
+{
+    std::size_t pending = _end - _begin;
+
+    // packets extracted from the chunk may have been released by other
+    // threads, make sure they are done reading before we overwrite the chunk
+    bool exclusive = _buffer && _buffer.use_count() == 1;
+    if (exclusive)
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+    // the chunk is ours alone, so we can reuse it from the start
+    if (exclusive && pending == 0)
+        _begin = _end = 0;
+
+    // if the header of the incomplete packet is there, we know how much room
+    // it will need. The header was already checked by nextPacket().
+    std::size_t required = pending + 1;
+    if (pending >= SegmentationLayerBase::min_header_length)
+    {
+        auto packet_begin = _buffer->begin() + _begin;
+        std::size_t header_length =
+            SegmentationLayerBase::peekHeaderLength(packet_begin);
+
+        if (pending >= header_length)
+            required = std::max<std::size_t>(required,
+                SegmentationLayerBase::decodeHeader(packet_begin).packetsize);
+        else
+            required = std::max(required, header_length);
+    }
+
+    // keep reading into the current chunk if there is room
+    if (_buffer && _end < _buffer->size() && _buffer->size() - _begin >= required)
+        return;
+
+    std::size_t new_size = std::max(required, _chunk_size);
+
+    // move the incomplete packet to the front if nobody else uses the chunk
+    if (exclusive && _buffer->size() >= new_size)
+    {
+        std::memmove(&(*_buffer)[0], &(*_buffer)[_begin], pending);
+    }
+    else
+    {
+        BufferPool::buffer_ptr_t new_buffer =
+            BufferPool::instance()->acquire(new_size);
+
+        if (pending)
+            std::memcpy(&(*new_buffer)[0], &(*_buffer)[_begin], pending);
+
+        _buffer = std::move(new_buffer);
+    }
+
+    _begin = 0;
+    _end = pending;
+}
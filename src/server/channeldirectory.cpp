@@ -0,0 +1,110 @@
+// channeldirectory.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "channeldirectory.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+
+
+bool ChannelDirectory::subscribe(
+    channel_id_t channel,
+    connection_id_t connection_id
+)
+{
+    boost::unique_lock<boost::shared_mutex> lock(directory_mutex);
+
+    std::vector<connection_id_t>& members = channel_members[channel];
+
+    auto pos = std::lower_bound(members.begin(), members.end(), connection_id);
+    if (pos != members.end() && *pos == connection_id)
+        return false;
+
+    members.insert(pos, connection_id);
+
+    // a connection is in few channels, a plain list is good enough
+    connection_channels[connection_id].push_back(channel);
+
+    return true;
+}
+
+bool ChannelDirectory::unsubscribe(
+    channel_id_t channel,
+    connection_id_t connection_id
+)
+{
+    boost::unique_lock<boost::shared_mutex> lock(directory_mutex);
+
+    if (!removeMember(channel, connection_id))
+        return false;
+
+    auto it = connection_channels.find(connection_id);
+    if (it != connection_channels.end())
+    {
+        std::vector<channel_id_t>& channels = it->second;
+        channels.erase(
+            std::remove(channels.begin(), channels.end(), channel),
+            channels.end()
+        );
+
+        if (channels.empty())
+            connection_channels.erase(it);
+    }
+
+    return true;
+}
+
+void ChannelDirectory::unsubscribeAll(connection_id_t connection_id)
+{
+    boost::unique_lock<boost::shared_mutex> lock(directory_mutex);
+
+    auto it = connection_channels.find(connection_id);
+    if (it == connection_channels.end())
+        return;
+
+    for (channel_id_t channel : it->second)
+        removeMember(channel, connection_id);
+
+    connection_channels.erase(it);
+}
+
+bool ChannelDirectory::removeMember(
+    channel_id_t channel,
+    connection_id_t connection_id
+)
+{
+    auto it = channel_members.find(channel);
+    if (it == channel_members.end())
+        return false;
+
+    std::vector<connection_id_t>& members = it->second;
+
+    auto pos = std::lower_bound(members.begin(), members.end(), connection_id);
+    if (pos == members.end() || *pos != connection_id)
+        return false;
+
+    members.erase(pos);
+
+    if (members.empty())
+        channel_members.erase(it);
+
+    return true;
+}
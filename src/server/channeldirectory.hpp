@@ -0,0 +1,104 @@
+// channeldirectory.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHANNELDIRECTORY_HPP
+#define CHANNELDIRECTORY_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <boost/thread/shared_mutex.hpp>
+
+#include "neartypes.hpp"
+#include "servevent.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** Members of every channel.
+*
+* The members of a channel are kept in a sorted vector of connection ids, so
+* delivering a message to a channel walks through a contiguous array, and
+* looking up a member is a binary search.
+*
+* This class is thread safe. Lookups may run concurrently, changes are
+* exclusive.
+*/
+class ChannelDirectory
+{
+public:
+    typedef ChannelMessage::channel_id_t channel_id_t;
+    typedef BasicServerEvent::connection_id_t connection_id_t;
+
+    /** Add a connection to a channel.
+    * @returns false if the connection was a member already.
+    */
+    bool subscribe(channel_id_t channel, connection_id_t connection_id);
+
+    /** Remove a connection from a channel.
+    * @returns false if the connection was no member.
+    */
+    bool unsubscribe(channel_id_t channel, connection_id_t connection_id);
+
+    /** Remove a connection from all channels. */
+    void unsubscribeAll(connection_id_t connection_id);
+
+    /** Call a function for every member of a channel.
+    * The directory is locked while the function runs, so it must not change
+    * the directory.
+    * @returns The number of members of the channel.
+    */
+    template <typename Function>
+    std::size_t forEachMember(channel_id_t channel, Function f) const
+    {
+        boost::shared_lock<boost::shared_mutex> lock(directory_mutex);
+
+        auto it = channel_members.find(channel);
+        if (it == channel_members.end())
+            return 0;
+
+        for (connection_id_t connection_id : it->second)
+            f(connection_id);
+
+        return it->second.size();
+    }
+
+private:
+    /** Sorted members of every channel. Empty channels are removed. */
+    std::unordered_map<channel_id_t, std::vector<connection_id_t>>
+        channel_members;
+
+    /** Channels of every connection, to clean up when it goes away */
+    std::unordered_map<connection_id_t, std::vector<channel_id_t>>
+        connection_channels;
+
+    mutable boost::shared_mutex directory_mutex;
+
+    /** Remove a connection from the members of a channel.
+    * The caller must hold the exclusive lock.
+    * @returns false if the connection was no member.
+    */
+    bool removeMember(channel_id_t channel, connection_id_t connection_id);
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef CHANNELDIRECTORY_HPP
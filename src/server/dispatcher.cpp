@@ -18,31 +18,73 @@
 */
 
 #include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <string>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
 #include "dispatcher.hpp"
+#include "bufferpool.hpp"
 
 using namespace nuke_ms;
 using namespace server;
 using boost::asio::ip::tcp;
 
-DispatchingServer::DispatchingServer()
-    : acceptor(io_service, tcp::endpoint(tcp::v4(), listening_port)),
-    current_conn_id(0)
+
+DispatchingServer::DispatchingServer(const ServerOptions& options)
+    : server_log(options.log_level, options.log_rate, std::cout),
+    acceptor(io_service, tcp::endpoint(tcp::v4(), listening_port)),
+    thread_count(options.thread_count),
+    send_limits(options.slow_consumer_policy, options.peer_send_limit,
+        options.total_send_limit),
+    stats_timer(io_service), stats_interval(options.stats_interval),
+    max_packetsize(options.max_packetsize), next_stream_id(1)
 {
+    // use one thread per core, if the number of threads was not specified
+    if (thread_count == 0)
+        thread_count = std::max(boost::thread::hardware_concurrency(), 1u);
+
     startAccept();
+
+    if (stats_interval)
+        startStatsTimer();
 }
 
 void DispatchingServer::run()
 {
+    // help boost::bind find the right overload
+    std::size_t (boost::asio::io_service::*r)() = &boost::asio::io_service::run;
+
+    // start additional threads, the calling thread is the last one
+    boost::thread_group threads;
+    for (unsigned i = 1; i < thread_count; ++i)
+        threads.create_thread(boost::bind(r, &io_service));
+
     io_service.run();
+
+    threads.join_all();
 }
 
 void DispatchingServer::handleServerEvent(const BasicServerEvent& evt)
 {
+    // The peer sending this event is still inside one of its handlers, so we
+    // must not delete it now. Defer the deletion to the io_service.
+    if (evt.event_kind == BasicServerEvent::ID_CAN_DELETE)
+    {
+        io_service.post(
+            boost::bind(&DispatchingServer::erasePeer, this, evt.connection_id)
+        );
+        return;
+    }
+
+    // the list is only read from here on
+    boost::shared_lock<boost::shared_mutex> lock(peers_mutex);
+
+    RemotePeer::ptr_t* peer = peers_list.find(evt.connection_id);
+
     // ignore everything that is not in the list
-    if (! peers_list.count(evt.connection_id) )
+    if (!peer)
         return;
 
     switch (evt.event_kind)
@@ -52,10 +94,20 @@ void DispatchingServer::handleServerEvent(const BasicServerEvent& evt)
             const ReceivedMessageEvent& rcvd_msg_evt =
                 static_cast<const ReceivedMessageEvent&>(evt);
 
-            std::cout<<"Received a message from "<<rcvd_msg_evt.connection_id<<
-                std::endl;
+            server_log.write(LogLevel::debug, LogCategory::message,
+                "Received a message", rcvd_msg_evt.connection_id);
+
+            const RemotePeer::packet_ptr_t& packet = rcvd_msg_evt.parm;
 
-            distributeMessage(rcvd_msg_evt.connection_id, rcvd_msg_evt.parm);
+            if (packet->header().isFragment())
+            {
+                relayFragment(**peer, packet);
+                break;
+            }
+
+            MessageRoute route;
+            if (routeMessage(**peer, packet->body(), route))
+                distributeMessage(rcvd_msg_evt.connection_id, route, packet);
 
             break;
         }
@@ -66,33 +118,54 @@ void DispatchingServer::handleServerEvent(const BasicServerEvent& evt)
             const ConnectionErrorEvent& error_evt =
                 static_cast<const ConnectionErrorEvent&>(evt);
 
-            std::cout<<"An error with the connection("<<
-                error_evt.connection_id<<") occured: "<<
-                byte_traits::native_string(error_evt.parm.begin(), error_evt.parm.end())<<
-                ". Closing this connection."<<std::endl;
+            server_log.write(LogLevel::warning, LogCategory::connection,
+                "Connection error, closing the connection",
+                error_evt.connection_id,
+                byte_traits::native_string(
+                    error_evt.parm.begin(), error_evt.parm.end()));
 
-            peers_list[error_evt.connection_id]->shutdownConnection();
+            (*peer)->shutdownConnection();
 
             break;
         }
 
-        case BasicServerEvent::ID_CAN_DELETE:
-        {
-            // delete the peer object if it existed
-            peers_list.erase(evt.connection_id);
-            break;
-        }
-
         default:
         {
 //             bool unknown_server_event = false;
 //             assert(unknown_server_event);
-            std::cout<<"Unknown server event\n";
+            server_log.write(LogLevel::error, LogCategory::server,
+                "Unknown server event", evt.connection_id);
             break;
         }
     }
 }
 
+void DispatchingServer::erasePeer(RemotePeer::connection_id_t connection_id)
+{
+    boost::unique_lock<boost::shared_mutex> lock(peers_mutex);
+
+    RemotePeer::ptr_t* peer = peers_list.find(connection_id);
+
+    // With the exclusive lock held, nobody can create new references to the
+    // peer. If a message was sent to it in the meantime, it will report
+    // ID_CAN_DELETE again when that handler has returned.
+    // A thread that released the last reference may still be reporting
+    // ID_CAN_DELETE. It holds a shared pointer to the peer, so the peer is
+    // only destroyed when that thread is done with it.
+    // The slot of the peer is reused for new peers, but with a new
+    // connection id.
+    if (peer && (*peer)->canBeDeleted())
+    {
+        peers_list.erase(connection_id);
+        user_directory.unregisterConnection(connection_id);
+        channel_directory.unsubscribeAll(connection_id);
+        stats.add(ServerStats::connections_closed);
+
+        server_log.write(LogLevel::info, LogCategory::connection,
+            "Client disconnected", connection_id);
+    }
+}
+
 void DispatchingServer::startAccept()
 {
     // create new socket
@@ -118,32 +191,55 @@ void DispatchingServer::acceptHandler(
 {
     if (e)
     {
-        std::cout<<"Accepting new clients failed due to an error: "<<
-            e.message()<<'\n';
+        server_log.write(LogLevel::error, LogCategory::server,
+            "Accepting new clients failed", 0, e.message());
 
         io_service.stop();
     }
     else
     {
-        std::cout<<"New client connected!\n";
-
-        RemotePeer::connection_id_t connection_id = getNextConnectionId();
-
-        // create new peer object
-        RemotePeer::ptr_t remote_peer(
-            new RemotePeer(
-                peer_socket,
-                connection_id,
-                boost::bind(
-                    &DispatchingServer::handleServerEvent,
-                    this,
-                    _1
-                )
-            )
-        );
-
-        // put peer object into the map
-        peers_list[connection_id] = remote_peer;
+        {
+            boost::unique_lock<boost::shared_mutex> lock(peers_mutex);
+
+            // reserve a slot, its identifier is the connection id
+            RemotePeer::connection_id_t connection_id =
+                peers_list.insert(RemotePeer::ptr_t());
+
+            // create new peer object. Its events wait for the lock, so none
+            // of them is lost before the peer is in the list.
+            try {
+                RemotePeer::ptr_t& peer = *peers_list.find(connection_id);
+
+                peer = RemotePeer::ptr_t(
+                    new RemotePeer(
+                        io_service,
+                        peer_socket,
+                        connection_id,
+                        boost::bind(
+                            &DispatchingServer::handleServerEvent,
+                            this,
+                            _1
+                        ),
+                        stats,
+                        send_limits,
+                        max_packetsize
+                    )
+                );
+
+                peer->startReceive();
+            }
+            catch (...)
+            {
+                // don't leave an empty slot behind
+                peers_list.erase(connection_id);
+                throw;
+            }
+
+            stats.add(ServerStats::connections_accepted);
+
+            server_log.write(LogLevel::info, LogCategory::connection,
+                "New client connected", connection_id);
+        }
 
         startAccept();
     }
@@ -151,23 +247,275 @@ void DispatchingServer::acceptHandler(
 }
 
 
-void DispatchingServer::distributeMessage(
-    RemotePeer::connection_id_t originating_id,
-    std::shared_ptr<SegmentationLayer<SerializedData>> data
+void DispatchingServer::startStatsTimer()
+{
+    stats_timer.expires_from_now(boost::posix_time::seconds(stats_interval));
+    stats_timer.async_wait(
+        boost::bind(
+            &DispatchingServer::writeStatistics,
+            this,
+            boost::asio::placeholders::error
+        )
+    );
+}
+
+void DispatchingServer::writeStatistics(const boost::system::error_code& e)
+{
+    if (e)
+        return;
+
+    std::ostringstream report;
+
+    stats.snapshot().print(report);
+
+    BufferPool::Statistics pool_stats = BufferPool::instance()->statistics();
+    report<<"\n\tbuffers acquired: "<<pool_stats.acquired<<
+        ", allocated: "<<pool_stats.allocated;
+
+    {
+        boost::shared_lock<boost::shared_mutex> lock(peers_mutex);
+
+        report<<"\n\tconnected peers: "<<peers_list.size()<<
+            ", bytes queued: "<<
+            send_limits.total_pending.load(std::memory_order_relaxed);
+
+        for (const RemotePeer::ptr_t& peer : peers_list)
+        {
+            RemotePeer::Statistics peer_stats = peer->statistics();
+            report<<"\n\tconnection "<<peer->getConnectionId()<<
+                ": messages in "<<peer_stats.messages_in<<
+                ", out "<<peer_stats.messages_out<<
+                ", bytes in "<<peer_stats.bytes_in<<
+                ", out "<<peer_stats.bytes_out<<
+                ", pending packets "<<peer_stats.pending_packets<<
+                " ("<<peer_stats.pending_bytes<<" bytes)"<<
+                ", dropped packets "<<peer_stats.dropped_packets;
+        }
+    }
+
+    server_log.write(LogLevel::info, LogCategory::server, "Statistics", 0,
+        report.str());
+
+    startStatsTimer();
+}
+
+
+// The caller must hold peers_mutex (at least shared)
+bool DispatchingServer::routeMessage(
+    RemotePeer& peer,
+    const SerializedData& body,
+    MessageRoute& route
+)
+{
+    ChannelMessage::operation_t operation;
+    ChannelMessage::channel_id_t channel;
+    if (ChannelMessage::peekHeader(body, operation, channel))
+    {
+        if (operation != ChannelMessage::OP_PUBLISH)
+        {
+            changeSubscription(peer.getConnectionId(), operation, channel);
+            return false;
+        }
+
+        route.kind = MessageRoute::to_channel;
+        route.channel = channel;
+        return true;
+    }
+
+    // packets that are no user messages go to everyone
+    UniqueUserID recipient, sender;
+    bool announcement = false;
+    if (NearUserMessageView::isUserMessage(body))
+    {
+        NearUserMessageView usermsg(body);
+        recipient = usermsg.recipient();
+        sender = usermsg.sender();
+
+        // a message without recipient and text only announces the sender
+        announcement = recipient == UniqueUserID::user_id_none
+            && usermsg.body().empty();
+    }
+
+    // the event callback runs in the strand of the peer, so its
+    // registered user can be checked without locking the directory
+    if (!(sender == UniqueUserID::user_id_none)
+        && !(sender == peer.registeredUser()))
+    {
+        user_directory.registerConnection(peer.getConnectionId(), sender);
+        peer.setRegisteredUser(sender);
+    }
+
+    if (announcement)
+        return false;
+
+    if (recipient == UniqueUserID::user_id_none)
+        route.kind = MessageRoute::to_everyone;
+    else
+    {
+        route.kind = MessageRoute::to_user;
+        route.recipient = recipient;
+    }
+
+    return true;
+}
+
+// The caller must hold peers_mutex (at least shared)
+void DispatchingServer::relayFragment(
+    RemotePeer& peer,
+    RemotePeer::packet_ptr_t packet
 )
 {
-    peers_list_type::iterator it = peers_list.begin();
+    const SegmentationLayerBase::HeaderType& header = packet->header();
+    RemotePeer::relayed_streams_type& streams = peer.relayedStreams();
+
+    auto stream = streams.find(header.stream_id);
 
-    for(; it != peers_list.end(); ++it )
+    // the first fragment decides where the message goes
+    if (!(header.flags & SegmentationLayerBase::FLAG_CONTINUED))
     {
-        it->second->sendMessage(*data);
+        MessageRoute route;
+        if (!routeMessage(peer, packet->body(), route))
+        {
+            if (stream != streams.end())
+                streams.erase(stream);
+            return;
+        }
+
+        if (stream == streams.end())
+        {
+            if (streams.size() >= max_relayed_streams)
+            {
+                stats.add(ServerStats::stray_fragments);
+                server_log.write(LogLevel::warning, LogCategory::message,
+                    "Too many fragmented messages, dropping a fragment",
+                    peer.getConnectionId());
+                return;
+            }
+
+            stream = streams.insert(
+                std::make_pair(header.stream_id, RelayedStream())).first;
+        }
+
+        // zero means "no stream", skip it when the counter wraps around
+        SegmentationLayerBase::stream_id_t relay_id;
+        do relay_id = next_stream_id.fetch_add(1, std::memory_order_relaxed);
+        while (!relay_id);
+
+        stream->second.relay_id = relay_id;
+        stream->second.route = route;
+    }
+    else if (stream == streams.end())
+    {
+        stats.add(ServerStats::stray_fragments);
+        return;
     }
+
+    // the body is shared, only the stream identifier changes
+    SegmentationLayerBase::HeaderType relay_header = header;
+    relay_header.stream_id = stream->second.relay_id;
+
+    const SerializedData& body = packet->body();
+    auto relayed = std::make_shared<const Packet>(
+        relay_header,
+        SerializedData(body.getOwnership(), body.begin(), body.size()),
+        packet->created()
+    );
+
+    distributeMessage(peer.getConnectionId(), stream->second.route, relayed);
+
+    if (!(header.flags & SegmentationLayerBase::FLAG_MORE))
+        streams.erase(stream);
 }
 
-RemotePeer::connection_id_t DispatchingServer::getNextConnectionId()
+// The caller must hold peers_mutex (at least shared)
+template <typename Function>
+std::size_t DispatchingServer::forEachRecipient(
+    RemotePeer::connection_id_t originating_id,
+    const MessageRoute& route,
+    Function f
+)
 {
-    return ++current_conn_id;
+    auto callFor = [&](RemotePeer::connection_id_t connection_id)
+    {
+        if (connection_id == originating_id)
+            return;
+
+        RemotePeer::ptr_t* peer = peers_list.find(connection_id);
+        if (peer)
+            f(**peer);
+    };
+
+    switch (route.kind)
+    {
+        case MessageRoute::to_everyone:
+        {
+            std::size_t recipient_count = 0;
+
+            for (const RemotePeer::ptr_t& peer : peers_list)
+                if (peer->getConnectionId() != originating_id)
+                {
+                    f(*peer);
+                    ++recipient_count;
+                }
+
+            return recipient_count;
+        }
+
+        case MessageRoute::to_user:
+            return user_directory.forEachConnection(route.recipient, callFor);
+
+        case MessageRoute::to_channel:
+            return channel_directory.forEachMember(route.channel, callFor);
+    }
+
+    return 0;
 }
 
+// The caller must hold peers_mutex (at least shared)
+void DispatchingServer::distributeMessage(
+    RemotePeer::connection_id_t originating_id,
+    const MessageRoute& route,
+    RemotePeer::packet_ptr_t packet
+)
+{
+    // A received packet keeps the whole chunk it was received into
+    // allocated, which the send limits don't see. If a small packet has to
+    // wait for a recipient, it gets a block of its own, so the chunk can be
+    // reused. The copy is made once, before the packet is handed out.
+    if (packet->pinnedSize() > 2 * packet->size())
+    {
+        bool waiting = false;
+        forEachRecipient(originating_id, route, [&](const RemotePeer& peer)
+            { waiting = waiting || peer.isSending(); });
+
+        if (waiting)
+            packet = packet->compacted();
+    }
 
+    // every recipient gets the same packet, only a reference is queued per
+    // recipient
+    std::size_t recipient_count = forEachRecipient(originating_id, route,
+        [&](RemotePeer& peer) { peer.sendMessage(packet); });
 
+    if (!recipient_count && route.kind != MessageRoute::to_everyone)
+        stats.add(ServerStats::undeliverable);
+}
+
+void DispatchingServer::changeSubscription(
+    RemotePeer::connection_id_t connection_id,
+    ChannelMessage::operation_t operation,
+    ChannelMessage::channel_id_t channel
+)
+{
+    if (operation == ChannelMessage::OP_SUBSCRIBE)
+    {
+        if (channel_directory.subscribe(channel, connection_id))
+            server_log.write(LogLevel::debug, LogCategory::connection,
+                "Subscribed to a channel", connection_id,
+                std::to_string(channel));
+    }
+    else if (channel_directory.unsubscribe(channel, connection_id))
+        server_log.write(LogLevel::debug, LogCategory::connection,
+            "Unsubscribed from a channel", connection_id,
+            std::to_string(channel));
+}
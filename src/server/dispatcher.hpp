@@ -21,33 +21,103 @@
 #ifndef DISPATCHER_HPP
 #define DISPATCHER_HPP
 
-#include <map>
+#include <atomic>
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
+#include "slottable.hpp"
 #include "remotepeer.hpp"
+#include "serverlog.hpp"
+#include "serverstats.hpp"
+#include "userdirectory.hpp"
+#include "channeldirectory.hpp"
 
 namespace nuke_ms
 {
 namespace server
 {
 
+/** Settings for the DispatchingServer. */
+struct ServerOptions
+{
+    /** Number of threads running the event loop.
+    * 0 means one thread per processor core.
+    */
+    unsigned thread_count;
+
+    /** Log records below this level are discarded */
+    LogLevel log_level;
+
+    /** Maximum number of log records per category and second */
+    unsigned log_rate;
+
+    /** Interval in seconds in which statistics are written to the log.
+    * 0 disables the statistics output.
+    */
+    unsigned stats_interval;
+
+    /** What to do with peers that don't keep up with the sent packets */
+    SlowConsumerPolicy slow_consumer_policy;
+
+    /** Maximum number of bytes queued for one peer, 0 means no limit */
+    std::size_t peer_send_limit;
+
+    /** Maximum number of bytes queued for all peers, 0 means no limit */
+    std::size_t total_send_limit;
+
+    /** Maximum size of a received packet, including the header.
+    * Larger messages must be sent in fragments.
+    */
+    std::size_t max_packetsize;
+
+    /** Default constructor, initialize to default values */
+    ServerOptions()
+        : thread_count(0), log_level(LogLevel::info), log_rate(100),
+        stats_interval(0),
+        slow_consumer_policy(SlowConsumerPolicy::disconnect),
+        peer_send_limit(1024*1024), total_send_limit(256*1024*1024),
+        max_packetsize(SegmentationLayerBase::default_max_packetsize)
+    {}
+};
+
 /** Main server class.
 *
 * This class represents the main class of the server.
 * To use it, create an instance and then call the run() member function.
 *
+* Every connection is registered for the user in the sender field of the
+* messages it sends. Clients announce their user when they connect, with a
+* user message that has neither recipient nor text; such a message is not
+* relayed. Messages with a recipient are delivered to all connections of
+* that user, messages without a recipient to everyone. A message is never
+* sent back to the connection it came from.
+*
+* Clients may subscribe to channels with ChannelMessages. Subscriptions are
+* handled by the server, published messages are relayed to all subscribers
+* of the channel.
+*
+* Fragments of large messages are relayed one by one as they arrive, to the
+* recipients determined from the first fragment. Fragments of different
+* messages and complete packets are interleaved, so a large message does not
+* hold up the ones behind it.
+*
+* All peers share one io_service which is run by several threads. Handlers of
+* a single peer are serialized by the peer's strand, the list of peers is
+* protected by a reader/writer lock.
 */
 class DispatchingServer
 {
 
 public:
 
-    DispatchingServer();
+    DispatchingServer(const ServerOptions& options = ServerOptions());
 
     /** Start the server.
     * This function makes the server begin his work. It will block until the
     * server has finished or an error occured.
+    * The calling thread is used as one of the event loop threads.
     * No exception will be thrown, however output may occur.
     */
     void run();
@@ -56,18 +126,62 @@ public:
 
 private:
     typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
-    typedef std::map<RemotePeer::connection_id_t, RemotePeer::ptr_t>
-        peers_list_type;
+    typedef SlotTable<RemotePeer::ptr_t> peers_list_type;
+
+    /** Log of the server.
+    * Declared first, so that it outlives everything that might write to it.
+    */
+    ServerLog server_log;
 
     boost::asio::io_service io_service;
     boost::asio::ip::tcp::acceptor acceptor;
 
-    /** A list with connected peers. */
+    /** Number of threads that run the io_service */
+    unsigned thread_count;
+
+    /** Counters of the server */
+    ServerStats stats;
+
+    /** Limits for the packets queued by the peers */
+    SendLimits send_limits;
+
+    /** Timer for writing the statistics */
+    boost::asio::deadline_timer stats_timer;
+
+    /** Interval of the statistics output in seconds, 0 if disabled */
+    unsigned stats_interval;
+
+    /** Maximum size of a received packet */
+    std::size_t max_packetsize;
+
+    /** Stream identifier for the next relayed fragmented message */
+    std::atomic<SegmentationLayerBase::stream_id_t> next_stream_id;
+
+    /** A list with connected peers.
+    * The connection id of a peer is its identifier in this table.
+    */
     peers_list_type peers_list;
 
+    /** Lock protecting peers_list.
+    * Lookups and message distribution take a shared lock, insertion and
+    * removal of peers take an exclusive lock.
+    */
+    boost::shared_mutex peers_mutex;
+
+    /** Connections of every user. If both are needed, peers_mutex is
+    * locked first.
+    */
+    UserDirectory user_directory;
+
+    /** Subscribers of every channel. If both are needed, peers_mutex is
+    * locked first.
+    */
+    ChannelDirectory channel_directory;
+
     constexpr static unsigned short listening_port = 34443;
 
-    RemotePeer::connection_id_t current_conn_id;
+    /** Maximum number of fragmented messages a peer may send at once */
+    constexpr static std::size_t max_relayed_streams = 16;
 
     /** Dispatch an asynchronous accept request.
     * The request will be processed when the run() member function is run.
@@ -82,12 +196,86 @@ private:
         socket_ptr peer_socket
     );
 
+    /** Remove a peer from the list if no handler references it anymore.
+    * Called through the io_service, so that the peer is never destroyed
+    * from within one of its own handlers.
+    */
+    void erasePeer(RemotePeer::connection_id_t connection_id);
+
+    /** Wait for the next statistics output */
+    void startStatsTimer();
+
+    /** Write the counters of the server and all peers to the log */
+    void writeStatistics(const boost::system::error_code& e);
+
+    /** Find out where a received message goes.
+    * Messages for the server itself are handled here. The peer is registered
+    * for the sender of user messages, announcements of the sender are not
+    * relayed.
+    * The caller must hold peers_mutex (at least shared), and call this only
+    * from the event callback of the peer.
+    * @param peer The peer the message came from
+    * @param body The message, or the first fragment of it
+    * @param route Is set to the recipients of the message
+    * @returns false if the message is not relayed.
+    */
+    bool routeMessage(
+        RemotePeer& peer,
+        const SerializedData& body,
+        MessageRoute& route
+    );
+
+    /** Relay a fragment of a large message.
+    * The caller must hold peers_mutex (at least shared), and call this only
+    * from the event callback of the peer.
+    * @param peer The peer the fragment came from
+    * @param packet The fragment
+    */
+    void relayFragment(RemotePeer& peer, RemotePeer::packet_ptr_t packet);
+
+    /** Call a function for every recipient of a message.
+    * The caller must hold peers_mutex (at least shared).
+    * @param originating_id The connection the message came from, it is
+    * skipped.
+    * @param route The recipients of the message
+    * @param f Function that is called with the RemotePeer of every recipient
+    * @returns The number of recipients, for messages to a user or channel
+    * including the originating connection and connections that are gone.
+    */
+    template <typename Function>
+    std::size_t forEachRecipient(
+        RemotePeer::connection_id_t originating_id,
+        const MessageRoute& route,
+        Function f
+    );
+
+    /** Send a packet to its recipients.
+    * If the packet would have to wait for one of them, and it references a
+    * chunk much larger than itself, it is copied into a block of its own
+    * first. The recipients share that copy.
+    * The caller must hold peers_mutex (at least shared).
+    * @param originating_id The connection the packet came from, it is never
+    * sent back there.
+    * @param route The recipients of the packet
+    * @param packet The packet
+    */
     void distributeMessage(
         RemotePeer::connection_id_t originating_id,
-        std::shared_ptr<SegmentationLayer<SerializedData>> data
+        const MessageRoute& route,
+        RemotePeer::packet_ptr_t packet
     );
 
-    RemotePeer::connection_id_t getNextConnectionId();
+    /** Subscribe a connection to a channel, or unsubscribe it.
+    * @param connection_id The connection
+    * @param operation ChannelMessage::OP_SUBSCRIBE or
+    * ChannelMessage::OP_UNSUBSCRIBE
+    * @param channel The channel
+    */
+    void changeSubscription(
+        RemotePeer::connection_id_t connection_id,
+        ChannelMessage::operation_t operation,
+        ChannelMessage::channel_id_t channel
+    );
 
 };
 
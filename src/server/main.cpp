@@ -18,19 +18,129 @@
 */
 
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
 
 #include "dispatcher.hpp"
 
 using boost::asio::ip::tcp;
 
 
-int main()
+/** Parse a non-negative number.
+* @return true on success, false if the string is not a number.
+*/
+static bool parseNumber(const char* str, unsigned long& value)
+{
+    char* end;
+    long parsed = std::strtol(str, &end, 10);
+    if (*str == '\0' || *end != '\0' || parsed < 0)
+        return false;
+
+    value = static_cast<unsigned long>(parsed);
+    return true;
+}
+
+/** Parse the command line into the server options.
+* Accepted arguments are:
+*   -t, --threads N     Number of event loop threads (default: one per core)
+*   -v, --verbose       Also log every relayed message
+*   -s, --stats N       Write statistics to the log every N seconds
+*   -q, --queue-limit N Maximum bytes queued for one client, 0 for no limit
+*   -m, --memory-limit N
+*                       Maximum bytes queued for all clients, 0 for no limit
+*   -p, --slow-policy disconnect|drop-oldest|drop-newest
+*                       What to do with clients exceeding the limits
+*   -x, --max-packet-size N
+*                       Maximum size of a received packet, at least 256
+*
+* @return true on success, false if the arguments could not be parsed.
+*/
+static bool parseCommandLine(
+    int argc,
+    char* argv[],
+    nuke_ms::server::ServerOptions& options
+)
 {
-    nuke_ms::server::DispatchingServer server;
+    using nuke_ms::server::SlowConsumerPolicy;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* option = argv[i];
+        unsigned long value;
+
+        if (!std::strcmp(option, "-v") || !std::strcmp(option, "--verbose"))
+        {
+            options.log_level = nuke_ms::server::LogLevel::debug;
+            continue;
+        }
+
+        // all other options take an argument
+        if (++i == argc)
+            return false;
+
+        if (!std::strcmp(option, "-p") || !std::strcmp(option, "--slow-policy"))
+        {
+            if (!std::strcmp(argv[i], "disconnect"))
+                options.slow_consumer_policy = SlowConsumerPolicy::disconnect;
+            else if (!std::strcmp(argv[i], "drop-oldest"))
+                options.slow_consumer_policy = SlowConsumerPolicy::drop_oldest;
+            else if (!std::strcmp(argv[i], "drop-newest"))
+                options.slow_consumer_policy = SlowConsumerPolicy::drop_newest;
+            else
+                return false;
+
+            continue;
+        }
+
+        if (!parseNumber(argv[i], value))
+            return false;
+
+        if (!std::strcmp(option, "-t") || !std::strcmp(option, "--threads"))
+            options.thread_count = static_cast<unsigned>(value);
+        else if (!std::strcmp(option, "-s") || !std::strcmp(option, "--stats"))
+            options.stats_interval = static_cast<unsigned>(value);
+        else if (!std::strcmp(option, "-q")
+            || !std::strcmp(option, "--queue-limit"))
+            options.peer_send_limit = value;
+        else if (!std::strcmp(option, "-m")
+            || !std::strcmp(option, "--memory-limit"))
+            options.total_send_limit = value;
+        else if (!std::strcmp(option, "-x")
+            || !std::strcmp(option, "--max-packet-size"))
+        {
+            // the first fragment of a message must hold the headers that
+            // are needed to route it
+            if (value < 256)
+                return false;
+
+            options.max_packetsize = value;
+        }
+        else
+            return false;
+    }
+
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    nuke_ms::server::ServerOptions options;
+
+    if (!parseCommandLine(argc, argv, options))
+    {
+        std::cerr<<"Usage: "<<argv[0]<<" [-t|--threads N] [-v|--verbose] "
+            "[-s|--stats N] [-q|--queue-limit N] [-m|--memory-limit N] "
+            "[-p|--slow-policy disconnect|drop-oldest|drop-newest] "
+            "[-x|--max-packet-size N]\n";
+        return 1;
+    }
+
+    nuke_ms::server::DispatchingServer server(options);
 
     server.run();
 
     std::cout<<"The server is terminating.\n";
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,69 @@
+// messageroute.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MESSAGEROUTE_HPP
+#define MESSAGEROUTE_HPP
+
+#include "msglayer.hpp"
+#include "neartypes.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** The recipients of a message */
+struct MessageRoute
+{
+    enum Kind
+    {
+        to_everyone,    /**< All connections */
+        to_user,        /**< All connections of a user */
+        to_channel      /**< All subscribers of a channel */
+    };
+
+    Kind kind;
+
+    /** The user, if kind is to_user */
+    UniqueUserID recipient;
+
+    /** The channel, if kind is to_channel */
+    ChannelMessage::channel_id_t channel;
+};
+
+/** A fragmented message that is being relayed.
+* The recipients are determined from the first fragment, the following
+* fragments take the same route.
+*/
+struct RelayedStream
+{
+    /** Stream identifier of the fragments that are sent to the recipients.
+    * Stream identifiers are chosen by the senders, so the server assigns
+    * identifiers of its own that are unique among all connections.
+    */
+    SegmentationLayerBase::stream_id_t relay_id;
+
+    /** Recipients of the message */
+    MessageRoute route;
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef MESSAGEROUTE_HPP
@@ -0,0 +1,190 @@
+// packet.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PACKET_HPP
+#define PACKET_HPP
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <boost/asio/buffer.hpp>
+
+#include "msglayer.hpp"
+#include "bufferpool.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** A complete segmentation layer packet, ready to be written to the network.
+*
+* The packet consists of the segmentation layer header and the body. The body
+* is not copied into a contiguous buffer, instead it is referenced in the
+* memory block it was received into, and header and body are written with a
+* single scatter-gather write.
+*
+* Packets are immutable once constructed, so a single packet can be shared by
+* all peers it is sent to.
+*/
+class Packet
+{
+public:
+    /** Type for a shared pointer to an immutable packet */
+    typedef std::shared_ptr<const Packet> ptr_t;
+
+    /** Type of the buffer sequence that can be passed to async_write */
+    typedef std::array<boost::asio::const_buffer, 2> const_buffers_type;
+
+    /** Construct a packet from a received header and body.
+    * The header is encoded again, the body is referenced.
+    * This is used to relay received packets without serializing them again.
+    *
+    * @param header The decoded header. Its packet size must match the body.
+    * @param body The received packet body.
+    * @param created Time the packet was received
+    */
+    Packet(
+        const SegmentationLayerBase::HeaderType& header,
+        SerializedData&& body,
+        std::chrono::steady_clock::time_point created =
+            std::chrono::steady_clock::now()
+    )
+        : _header(header), _body(std::move(body)), _created(created)
+    {
+        SegmentationLayerBase::encodeHeader(_headerbuf, _header);
+    }
+
+    /** Construct a packet from a message that is already serialized.
+    * The body is referenced in the memory block it is stored in, only the
+    * header is generated.
+    *
+    * @param msg The message that shall be sent.
+    */
+    explicit Packet(const SegmentationLayer<SerializedData>& msg)
+        : _header(SegmentationLayerBase::makeHeader(msg._inner_layer.size())),
+        _body(msg._inner_layer.getOwnership(), msg._inner_layer.begin(),
+            msg._inner_layer.size()),
+        _created(std::chrono::steady_clock::now())
+    {
+        SegmentationLayerBase::encodeHeader(_headerbuf, _header);
+    }
+
+    /** Construct a packet by serializing a message.
+    * The inner layer of the message is serialized into a new buffer, the
+    * header is generated.
+    *
+    * @param msg The message that shall be sent.
+    */
+    template <typename InnerLayer>
+    explicit Packet(const SegmentationLayer<InnerLayer>& msg)
+        : _header(SegmentationLayerBase::makeHeader(msg._inner_layer.size())),
+        _body(serializeInnerLayer(msg._inner_layer)),
+        _created(std::chrono::steady_clock::now())
+    {
+        SegmentationLayerBase::encodeHeader(_headerbuf, _header);
+    }
+
+    /** Return the segmentation layer header of the packet. */
+    const SegmentationLayerBase::HeaderType& header() const
+    { return _header; }
+
+    /** Return the body of the packet, without the segmentation header. */
+    const SerializedData& body() const
+    { return _body; }
+
+    /** Return the time the packet was received or created. */
+    std::chrono::steady_clock::time_point created() const
+    { return _created; }
+
+    /** Return the size of the packet, including the header. */
+    std::size_t size() const
+    { return _header.packetsize; }
+
+    /** Return the number of bytes this packet keeps allocated.
+    * A received packet references the whole chunk it was received into.
+    */
+    std::size_t pinnedSize() const
+    {
+        std::shared_ptr<const byte_traits::byte_sequence> block =
+            _body.getOwnership();
+
+        return std::max(size(), block ? block->size() : std::size_t(0));
+    }
+
+    /** Return a copy of this packet with the body in a memory block of its
+    * own, taken from the BufferPool.
+    */
+    ptr_t compacted() const
+    {
+        BufferPool::buffer_ptr_t block =
+            BufferPool::instance()->acquire(_body.size());
+        std::copy(_body.begin(), _body.begin() + _body.size(), block->begin());
+
+        return std::make_shared<const Packet>(_header,
+            SerializedData(block, block->begin(), _body.size()), _created);
+    }
+
+    /** Return the buffers of this packet.
+    * The buffers are valid as long as this object is alive.
+    */
+    const_buffers_type buffers() const
+    {
+        const_buffers_type bufs = {{
+            boost::asio::buffer(_headerbuf, _header.headerLength()),
+            _body.size() ?
+                boost::asio::buffer(&*_body.begin(), _body.size()) :
+                boost::asio::const_buffer()
+        }};
+
+        return bufs;
+    }
+
+private:
+    /** The segmentation layer header */
+    SegmentationLayerBase::HeaderType _header;
+
+    /** The encoded segmentation layer header */
+    byte_traits::byte_t _headerbuf[SegmentationLayerBase::max_header_length];
+
+    /** The body of the packet */
+    SerializedData _body;
+
+    /** Time the packet was received or created */
+    std::chrono::steady_clock::time_point _created;
+
+    template <typename InnerLayer>
+    static SerializedData serializeInnerLayer(const InnerLayer& inner_layer)
+    {
+        auto data =
+            std::make_shared<byte_traits::byte_sequence>(inner_layer.size());
+        inner_layer.fillSerialized(data->begin());
+
+        return SerializedData(data, data->begin(), data->size());
+    }
+
+    // packets are shared, not copied
+    Packet(const Packet&) = delete;
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef PACKET_HPP
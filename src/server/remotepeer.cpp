@@ -19,6 +19,7 @@
 
 #include "remotepeer.hpp"
 
+#include <algorithm>
 #include <boost/bind.hpp>
 
 using namespace nuke_ms;
@@ -26,29 +27,45 @@ using namespace server;
 
 
 RemotePeer::RemotePeer(
+    boost::asio::io_service& io_service,
     socket_ptr _peer_socket,
     connection_id_t _connection_id,
-    event_callback_t _event_callback
+    event_callback_t _event_callback,
+    ServerStats& _server_stats,
+    SendLimits& _send_limits,
+    std::size_t max_packetsize
 )
     : ReferenceCounter<RemotePeer>(boost::bind(&RemotePeer::canDelete, this)),
-    peer_socket(_peer_socket), connection_id(_connection_id),
-    event_callback(_event_callback), error_happened(false)
+    peer_socket(_peer_socket), strand(io_service), connection_id(_connection_id),
+    event_callback(_event_callback), reader(max_packetsize),
+    error_happened(false),
+    write_in_progress(false),
+    slow_consumer(false),
+    server_stats(_server_stats),
+    send_limits(_send_limits),
+    messages_in(0), messages_out(0), bytes_in(0), bytes_out(0),
+    pending_packets(0), pending_bytes(0), dropped_packets(0)
+{}
+
+RemotePeer::~RemotePeer()
 {
-    startReceive();
+    // give back what is still accounted to this peer
+    send_limits.total_pending.fetch_sub(
+        pending_bytes.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
 }
 
 void RemotePeer::startReceive()
 {
-    // start an asynchrous read
-    async_read(
-        *peer_socket,
-        boost::asio::buffer(header_buffer, SegmentationLayerBase::header_length),
-        boost::bind(
-            &RemotePeer::rcvHeaderHandler,
+    // read whatever is available, the packets are split up afterwards
+    peer_socket->async_read_some(
+        reader.prepare(),
+        strand.wrap(boost::bind(
+            &RemotePeer::receiveHandler,
             boost::asio::placeholders::error,
             boost::asio::placeholders::bytes_transferred,
-            ReferenceCounter<RemotePeer>::CountedReference(*this)
-        )
+            HandlerReference(*this)
+        ))
     );
 }
 
@@ -77,133 +94,423 @@ void RemotePeer::postError(const byte_traits::native_string& errmsg)
 void RemotePeer::sendHandler(
     const boost::system::error_code& error,
     std::size_t bytes_transferred,
-    ReferenceCounter<RemotePeer>::CountedReference peer_reference,
-    std::shared_ptr<byte_traits::byte_sequence> sendbuf
+    HandlerReference peer_reference
 )
 {
     // import reference for convenience
     RemotePeer& remotepeer = peer_reference;
 
-    // nothing to do if everything went fine
+    std::size_t written_packets = remotepeer.writing_packets.size();
+    std::size_t written_bytes = 0;
+    for (const packet_ptr_t& packet : remotepeer.writing_packets)
+        written_bytes += packet->size();
+
     if (!error)
+    {
+        remotepeer.messages_out.fetch_add(
+            written_packets, std::memory_order_relaxed);
+        remotepeer.bytes_out.fetch_add(
+            bytes_transferred, std::memory_order_relaxed);
+        remotepeer.server_stats.add(ServerStats::messages_out, written_packets);
+        remotepeer.server_stats.add(ServerStats::bytes_out, bytes_transferred);
+
+        // time from the reception of each packet until it was written
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        for (const packet_ptr_t& packet : remotepeer.writing_packets)
+            remotepeer.server_stats.addLatency(now - packet->created());
+    }
+
+    remotepeer.releasePending(written_packets, written_bytes);
+
+    // the written packets are not needed anymore
+    remotepeer.writing_packets.clear();
+    remotepeer.writing_buffers.clear();
+
+    if (error)
+    {
+        // drop everything that was queued, the connection is unusable
+        {
+            boost::mutex::scoped_lock lock(remotepeer.send_mutex);
+
+            std::size_t queued_bytes = 0;
+            for (const packet_ptr_t& packet : remotepeer.send_queue)
+                queued_bytes += packet->size();
+
+            remotepeer.releasePending(
+                remotepeer.send_queue.size(), queued_bytes);
+            remotepeer.send_queue.clear();
+            remotepeer.write_in_progress = false;
+        }
+
+        remotepeer.postError(error.message());
         return;
+    }
+
+    // write everything that was queued in the meantime
+    {
+        boost::mutex::scoped_lock lock(remotepeer.send_mutex);
+        if (remotepeer.send_queue.empty())
+        {
+            remotepeer.write_in_progress = false;
+            return;
+        }
+    }
 
-    // otherwise report error
-    remotepeer.postError(error.message());
+    startWrite(peer_reference);
 }
 
-void RemotePeer::rcvHeaderHandler(
+void RemotePeer::receiveHandler(
     const boost::system::error_code& error,
     std::size_t bytes_transferred,
-    ReferenceCounter<RemotePeer>::CountedReference peer_reference
+    HandlerReference peer_reference
 )
 {
     // import reference for convenience
     RemotePeer& remotepeer = peer_reference;
 
+    // on error, set the error string. The rest will be handled by the refernce
+    // counter.
     if (error)
     {
-        // report error
         remotepeer.postError(error.message());
+        return;
     }
-    else
-    {
-        try {
-            // validate header and get packet size
-            SegmentationLayerBase::HeaderType header(
-                SegmentationLayerBase::decodeHeader(remotepeer.header_buffer)
-            );
-
 
+    remotepeer.reader.commit(bytes_transferred);
 
-/// FIXME Magic number, set to something proper or make configurable
-const byte_traits::uint2b_t MAX_PACKETSIZE = 0x8FFF;
+    remotepeer.bytes_in.fetch_add(bytes_transferred, std::memory_order_relaxed);
+    remotepeer.server_stats.add(ServerStats::bytes_in, bytes_transferred);
 
-            if (header.packetsize > MAX_PACKETSIZE)
-                throw InvalidHeaderError();
-
-            auto body_data = std::make_shared<byte_traits::byte_sequence>(
-                header.packetsize-SegmentationLayerBase::header_length
+    try {
+        // dispatch every complete packet that was received
+        SerializedData data({}, {}, 0);
+        while (remotepeer.reader.nextPacket(data))
+        {
+            // keep the body where it was received, so the packet can be
+            // relayed without serializing it again
+            SegmentationLayerBase::HeaderType header =
+                SegmentationLayerBase::decodeHeader(data.begin());
+
+            auto packet = std::make_shared<const Packet>(
+                header,
+                SerializedData{
+                    data.getOwnership(),
+                    data.begin() + header.headerLength(),
+                    header.payloadSize()
+                }
             );
 
-            // start a receive for the packet body_data
-            async_read(
-                *remotepeer.peer_socket,
-                boost::asio::buffer(*body_data),
-                boost::bind(
-                    &RemotePeer::rcvBodyHandler,
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred,
-                    peer_reference,
-                    body_data
-                )
+            remotepeer.messages_in.fetch_add(1, std::memory_order_relaxed);
+            remotepeer.server_stats.add(ServerStats::messages_in);
+
+            remotepeer.event_callback(
+                ReceivedMessageEvent(remotepeer.connection_id, packet)
             );
         }
-        catch(const InvalidHeaderError& e)
-        {
-            remotepeer.postError(e.what());
-        }
-
     }
+    catch(const InvalidHeaderError& e)
+    {
+        remotepeer.server_stats.add(ServerStats::header_errors);
+        remotepeer.postError(e.what());
+        return;
+    }
+    catch(const OversizedPacketError& e)
+    {
+        remotepeer.server_stats.add(ServerStats::oversized_packets);
+        remotepeer.postError(e.what());
+        return;
+    }
+    catch(const MsgLayerError& e)
+    {
+        remotepeer.postError(e.what());
+        return;
+    }
+
+    // renew receive Call
+    remotepeer.startReceive();
 }
 
-void RemotePeer::rcvBodyHandler(
-    const boost::system::error_code& error,
-    std::size_t bytes_transferred,
-    ReferenceCounter<RemotePeer>::CountedReference peer_reference,
-    std::shared_ptr<byte_traits::byte_sequence> body_data
+
+void RemotePeer::sendMessage(const SegmentationLayer<SerializedData>& msg)
+{
+    sendMessage(std::make_shared<const Packet>(msg));
+}
+
+bool RemotePeer::overSendLimits(std::size_t packet_size) const
+{
+    std::size_t peer_pending = pending_bytes.load(std::memory_order_relaxed);
+
+    // a single packet is always accepted
+    if (!peer_pending)
+        return false;
+
+    if (send_limits.peer_limit
+        && peer_pending + packet_size > send_limits.peer_limit)
+        return true;
+
+    return send_limits.total_limit
+        && send_limits.total_pending.load(std::memory_order_relaxed)
+            + packet_size > send_limits.total_limit;
+}
+
+void RemotePeer::releasePending(std::size_t packets, std::size_t bytes)
+{
+    pending_packets.fetch_sub(packets, std::memory_order_relaxed);
+    pending_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    send_limits.total_pending.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void RemotePeer::countDropped(std::size_t packets)
+{
+    dropped_packets.fetch_add(packets, std::memory_order_relaxed);
+    server_stats.add(ServerStats::dropped_packets, packets);
+}
+
+void RemotePeer::dropStream(const SegmentationLayerBase::HeaderType& header)
+{
+    // nothing follows packets that are not fragments, or the last fragment
+    if (!(header.flags & SegmentationLayerBase::FLAG_MORE)
+        || std::find(dropped_streams.begin(), dropped_streams.end(),
+            header.stream_id) != dropped_streams.end())
+        return;
+
+    if (dropped_streams.size() == max_dropped_streams)
+        dropped_streams.pop_front();
+
+    dropped_streams.push_back(header.stream_id);
+}
+
+bool RemotePeer::inDroppedStream(
+    const SegmentationLayerBase::HeaderType& header)
+{
+    if (!header.isFragment())
+        return false;
+
+    auto stream = std::find(dropped_streams.begin(), dropped_streams.end(),
+        header.stream_id);
+
+    if (stream == dropped_streams.end())
+        return false;
+
+    // the stream is complete with its last fragment
+    if (!(header.flags & SegmentationLayerBase::FLAG_MORE))
+        dropped_streams.erase(stream);
+
+    return true;
+}
+
+void RemotePeer::reportSlowConsumer(
+    HandlerReference peer_reference
 )
 {
     RemotePeer& remotepeer = peer_reference;
 
-    // on error, set the error string. The rest will be handled by the refernce
-    // counter.
-    if (error)
-    {
-        remotepeer.postError(error.message());
-    }
-    else
+    remotepeer.postError("Send queue limit exceeded");
+}
+
+void RemotePeer::sendMessage(packet_ptr_t packet)
+{
+    std::size_t packet_size = packet->size();
+    const SegmentationLayerBase::HeaderType& header = packet->header();
+
     {
-        auto segmlayer = std::make_shared<SegmentationLayer<SerializedData>>(
-            SerializedData{body_data, body_data->begin(), body_data->size()}
-        );
+        boost::mutex::scoped_lock lock(send_mutex);
 
-        // if the receive was ok, post the passage back to the enclosing entity
-        remotepeer.event_callback(
-            ReceivedMessageEvent(remotepeer.connection_id, segmlayer)
-        );
+        // a slow consumer that is being disconnected gets nothing anymore
+        if (slow_consumer)
+        {
+            countDropped(1);
+            return;
+        }
+
+        // the rest of a message is useless once a fragment of it was dropped
+        if (!dropped_streams.empty() && inDroppedStream(header))
+        {
+            countDropped(1);
+            return;
+        }
+
+        if (overSendLimits(packet_size))
+        {
+            switch (send_limits.policy)
+            {
+                case SlowConsumerPolicy::drop_newest:
+                    dropStream(header);
+                    countDropped(1);
+                    return;
+
+                case SlowConsumerPolicy::drop_oldest:
+                {
+                    bool fragment_dropped = false;
+
+                    // packets that are being written can't be dropped
+                    while (!send_queue.empty() && overSendLimits(packet_size))
+                    {
+                        const packet_ptr_t& oldest = send_queue.front();
+
+                        if (oldest->header().isFragment())
+                        {
+                            dropStream(oldest->header());
+                            fragment_dropped = true;
+                        }
+
+                        releasePending(1, oldest->size());
+                        send_queue.pop_front();
+                        countDropped(1);
+                    }
+
+                    // drop the queued fragments that follow a dropped one
+                    if (fragment_dropped)
+                    {
+                        std::size_t dropped = 0, dropped_bytes = 0;
+
+                        for (auto it = send_queue.begin();
+                            it != send_queue.end(); )
+                        {
+                            if (inDroppedStream((*it)->header()))
+                            {
+                                ++dropped;
+                                dropped_bytes += (*it)->size();
+                                it = send_queue.erase(it);
+                            }
+                            else
+                                ++it;
+                        }
+
+                        releasePending(dropped, dropped_bytes);
+                        countDropped(dropped);
+
+                        if (inDroppedStream(header))
+                        {
+                            countDropped(1);
+                            return;
+                        }
+                    }
+
+                    if (overSendLimits(packet_size))
+                    {
+                        dropStream(header);
+                        countDropped(1);
+                        return;
+                    }
+
+                    break;
+                }
+
+                case SlowConsumerPolicy::disconnect:
+                {
+                    slow_consumer = true;
+
+                    std::size_t queued_bytes = 0;
+                    for (const packet_ptr_t& queued : send_queue)
+                        queued_bytes += queued->size();
+
+                    releasePending(send_queue.size(), queued_bytes);
+                    countDropped(send_queue.size() + 1);
+                    send_queue.clear();
+
+                    server_stats.add(ServerStats::slow_consumers);
+
+                    strand.post(
+                        boost::bind(
+                            &RemotePeer::reportSlowConsumer,
+                            HandlerReference(*this)
+                        )
+                    );
+
+                    return;
+                }
+            }
+        }
+
+        send_queue.push_back(std::move(packet));
+        pending_packets.fetch_add(1, std::memory_order_relaxed);
+        pending_bytes.fetch_add(packet_size, std::memory_order_relaxed);
+        send_limits.total_pending.fetch_add(
+            packet_size, std::memory_order_relaxed);
+
+        // the running write will pick up the packet when it has completed
+        if (write_in_progress)
+            return;
 
-        // renew receive Call
-        remotepeer.startReceive();
+        write_in_progress = true;
     }
-}
 
+    // the socket must only be used from within our strand
+    strand.post(
+        boost::bind(
+            &RemotePeer::startWrite,
+            HandlerReference(*this)
+        )
+    );
+}
 
-void RemotePeer::sendMessage(const SegmentationLayer<SerializedData>& msg)
+void RemotePeer::startWrite(
+    HandlerReference peer_reference
+)
 {
-    auto data = std::make_shared<byte_traits::byte_sequence>(msg.size());
+    RemotePeer& remotepeer = peer_reference;
 
-    msg.fillSerialized(data->begin());
+    // take all queued packets
+    {
+        boost::mutex::scoped_lock lock(remotepeer.send_mutex);
+        remotepeer.writing_packets.swap(remotepeer.send_queue);
+    }
 
-    // write the Message onto the line
+    // gather the buffers of all packets into one sequence
+    for (const packet_ptr_t& packet : remotepeer.writing_packets)
+    {
+        Packet::const_buffers_type bufs = packet->buffers();
+        remotepeer.writing_buffers.insert(
+            remotepeer.writing_buffers.end(), bufs.begin(), bufs.end());
+    }
+
+    // write all packets onto the line at once
     boost::asio::async_write(
-        *peer_socket,
-        boost::asio::buffer(*data),
-        boost::bind(
+        *remotepeer.peer_socket,
+        remotepeer.writing_buffers,
+        remotepeer.strand.wrap(boost::bind(
             &RemotePeer::sendHandler,
             boost::asio::placeholders::error,
             boost::asio::placeholders::bytes_transferred,
-            ReferenceCounter<RemotePeer>::CountedReference(*this),
-            data
-        )
+            peer_reference
+        ))
     );
 }
 
+RemotePeer::Statistics RemotePeer::statistics() const
+{
+    Statistics stats;
+    stats.messages_in = messages_in.load(std::memory_order_relaxed);
+    stats.messages_out = messages_out.load(std::memory_order_relaxed);
+    stats.bytes_in = bytes_in.load(std::memory_order_relaxed);
+    stats.bytes_out = bytes_out.load(std::memory_order_relaxed);
+    stats.pending_packets = pending_packets.load(std::memory_order_relaxed);
+    stats.pending_bytes = pending_bytes.load(std::memory_order_relaxed);
+    stats.dropped_packets = dropped_packets.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
 void RemotePeer::shutdownConnection()
 {
+    strand.post(
+        boost::bind(
+            &RemotePeer::closeSocket,
+            HandlerReference(*this)
+        )
+    );
+}
+
+void RemotePeer::closeSocket(
+    HandlerReference peer_reference
+)
+{
+    RemotePeer& remotepeer = peer_reference;
     boost::system::error_code dontcare;
 
-    peer_socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both,dontcare);
-    peer_socket->close(dontcare);
+    remotepeer.peer_socket->shutdown(
+        boost::asio::ip::tcp::socket::shutdown_both, dontcare);
+    remotepeer.peer_socket->close(dontcare);
 }
-
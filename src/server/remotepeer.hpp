@@ -20,18 +20,71 @@
 #ifndef REMOTEPEER_HPP
 #define REMOTEPEER_HPP
 
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <unordered_map>
 #include <boost/asio.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "msglayer.hpp"
+#include "neartypes.hpp"
+#include "segmentationreader.hpp"
 #include "refcounter.hpp"
 #include "servevent.hpp"
+#include "serverstats.hpp"
+#include "messageroute.hpp"
 
 namespace nuke_ms
 {
 namespace server
 {
 
-class RemotePeer : public ReferenceCounter<RemotePeer>
+/** What to do with a peer that does not read its packets fast enough */
+enum class SlowConsumerPolicy
+{
+    drop_oldest,    /**< Drop the oldest queued packets to make room */
+    drop_newest,    /**< Drop the packet that does not fit anymore */
+    disconnect      /**< Close the connection to the peer */
+};
+
+/** Limits for the packets that are queued for sending.
+*
+* A packet counts against the limits of every peer it is queued for, from the
+* moment it is queued until it was written. Packets that are shared by several
+* peers are counted for each of them.
+*
+* A peer is over its limits if a new packet would exceed its own limit or the
+* limit of all peers. A peer that has nothing queued always accepts a packet,
+* so a single packet bigger than the limit is still delivered.
+*/
+struct SendLimits
+{
+    /** What to do if a peer is over its limits */
+    SlowConsumerPolicy policy;
+
+    /** Maximum number of bytes queued for one peer, 0 means no limit */
+    std::size_t peer_limit;
+
+    /** Maximum number of bytes queued for all peers, 0 means no limit */
+    std::size_t total_limit;
+
+    /** Number of bytes currently queued for all peers */
+    std::atomic<std::size_t> total_pending;
+
+    SendLimits(
+        SlowConsumerPolicy policy_,
+        std::size_t peer_limit_,
+        std::size_t total_limit_
+    )
+        : policy(policy_), peer_limit(peer_limit_), total_limit(total_limit_),
+        total_pending(0)
+    {}
+};
+
+class RemotePeer : public ReferenceCounter<RemotePeer>,
+    public boost::enable_shared_from_this<RemotePeer>
 {
     /** Typedef for pointer to a socket */
     typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
@@ -44,16 +97,102 @@ public:
 
     typedef boost::shared_ptr<RemotePeer> ptr_t;
 
+    /** Reference that every handler of a peer holds.
+    * The counted reference tells the server when all handlers have returned.
+    * The shared pointer keeps the peer alive until the counted reference was
+    * released and canDelete() has returned, even if the server removed the
+    * peer from its list in the meantime.
+    */
+    class HandlerReference
+    {
+        /** Declared first, so that it is released last */
+        ptr_t peer;
+
+        ReferenceCounter<RemotePeer>::CountedReference reference;
+
+    public:
+        /** Constructor.
+        * @param remotepeer A peer that is owned by a ptr_t.
+        */
+        explicit HandlerReference(RemotePeer& remotepeer)
+            : peer(remotepeer.shared_from_this()), reference(remotepeer)
+        {}
+
+        /** Returns a reference to the peer. */
+        operator RemotePeer& ()
+        { return reference; }
+    };
+
+    /** Counters of a single connection */
+    struct Statistics
+    {
+        unsigned long long messages_in;
+        unsigned long long messages_out;
+        unsigned long long bytes_in;
+        unsigned long long bytes_out;
+
+        /** Packets queued or being written */
+        std::size_t pending_packets;
+
+        /** Bytes queued or being written */
+        std::size_t pending_bytes;
+
+        /** Packets dropped because the peer was over its send limits */
+        unsigned long long dropped_packets;
+    };
+
 
     RemotePeer(
+        boost::asio::io_service& io_service,
         socket_ptr _peer_socket,
         connection_id_t _connection_id,
-        event_callback_t _event_callback
+        event_callback_t _event_callback,
+        ServerStats& _server_stats,
+        SendLimits& _send_limits,
+        std::size_t max_packetsize
     );
 
+    /** Destructor, releases the packets that are still accounted. */
+    ~RemotePeer();
+
+    /** Start receiving messages.
+    * The handlers hold shared pointers to the peer, so call this only after
+    * the peer is owned by a ptr_t.
+    */
+    void startReceive();
 
+
+    /** Type for an immutable packet that can be sent to several peers
+    * without copying it.
+    */
+    typedef Packet::ptr_t packet_ptr_t;
+
+    /** Send a message to the remote peer.
+    * The message is serialized into a new buffer that is then sent.
+    * This function may be called from any thread, the actual write is
+    * dispatched through the strand of this peer.
+    */
     void sendMessage(const SegmentationLayer<SerializedData>& msg);
 
+    /** Send a packet to the remote peer.
+    * The packet is referenced until the write has completed.
+    * Only one write is in progress at a time. Packets that are sent while a
+    * write is in progress are queued, and all queued packets are written
+    * together with a single gathering write when the previous write has
+    * completed. Packets are written in the order they were sent.
+    * If the peer is over its send limits, the SendLimits::policy decides
+    * which packets are dropped, or whether the peer is disconnected.
+    * This function may be called from any thread.
+    */
+    void sendMessage(packet_ptr_t packet);
+
+    /** Check whether packets are queued or being written to this peer.
+    * A packet sent now would have to wait.
+    * This function may be called from any thread.
+    */
+    bool isSending() const
+    { return pending_bytes.load(std::memory_order_relaxed) != 0; }
+
 
     /** Shutdown the connection to the remote peer.
     * This function closes the connected socket.
@@ -61,58 +200,187 @@ public:
     * returned.
     * When this has happened, an event with eventtype ID_CAN_DELETE
     * will be sent to the callback specified in the constructor.
+    * This function may be called from any thread.
     */
     void shutdownConnection();
 
+    /** Check whether this object may be deleted.
+    * @return true if no handler holds a reference to this object anymore.
+    * @note Only meaningful if nobody can create new references concurrently.
+    */
+    bool canBeDeleted() const
+    { return getRefCount() == 0; }
+
+    /** Return the identifier of this connection */
+    connection_id_t getConnectionId() const
+    { return connection_id; }
+
+    /** Return the user this connection was registered for.
+    * Only call this from the event callback.
+    */
+    const UniqueUserID& registeredUser() const
+    { return registered_user; }
+
+    /** Remember the user this connection was registered for.
+    * Only call this from the event callback.
+    */
+    void setRegisteredUser(const UniqueUserID& user)
+    { registered_user = user; }
+
+    /** Type for the fragmented messages of a peer that are being relayed,
+    * by the stream identifier the peer chose.
+    */
+    typedef std::unordered_map<SegmentationLayerBase::stream_id_t,
+        RelayedStream> relayed_streams_type;
+
+    /** Return the fragmented messages of this peer that are being relayed.
+    * Only call this from the event callback.
+    */
+    relayed_streams_type& relayedStreams()
+    { return relayed_streams; }
+
+    /** Return the counters of this connection.
+    * This function may be called from any thread.
+    */
+    Statistics statistics() const;
+
 private:
 
     socket_ptr peer_socket; /**< The socket this Peer is associated with */
 
+    /** Strand serializing all handlers that touch the socket or the state
+    * of this peer, so the server can run its io_service on multiple threads.
+    */
+    boost::asio::io_service::strand strand;
+
     /**< An ID to identify the Peer at the server */
     const connection_id_t connection_id;
 
     /** Callback where events will be reported.*/
     event_callback_t event_callback;
 
-    /** A static buffer for the header */
-    byte_traits::byte_t header_buffer[SegmentationLayerBase::header_length];
+    /** Splits the received data into packets.
+    * Only accessed from within the strand. */
+    SegmentationStreamReader reader;
+
+    /** User this connection is registered for in the server's directory.
+    * Only accessed from the event callback, which runs in the strand. */
+    UniqueUserID registered_user;
+
+    /** Fragmented messages that are being relayed.
+    * Only accessed from the event callback, which runs in the strand. */
+    relayed_streams_type relayed_streams;
 
     /** A variable that will prevent duplicate error messages.
     * Only the first error will be reported. */
     bool error_happened;
 
-    /**
+    /** Packets waiting to be written. Protected by send_mutex. */
+    std::deque<packet_ptr_t> send_queue;
+
+    /** True while a write operation is in progress or about to be started.
+    * Protected by send_mutex. */
+    bool write_in_progress;
+
+    /** True if the peer was over its send limits and is disconnected.
+    * Protected by send_mutex. */
+    bool slow_consumer;
+
+    /** Relayed messages of which a fragment was dropped.
+    * The recipient can't tell that a fragment is missing, so the remaining
+    * fragments of such a message are dropped as well. Protected by
+    * send_mutex.
     */
-    void startReceive();
+    std::deque<SegmentationLayerBase::stream_id_t> dropped_streams;
+
+    /** Maximum size of dropped_streams. Streams that were never finished
+    * would fill it up otherwise, the oldest one is forgotten.
+    */
+    static constexpr std::size_t max_dropped_streams = 64;
+
+    /** Mutex protecting the send queue */
+    boost::mutex send_mutex;
+
+    /** Packets of the write operation currently in progress.
+    * Only accessed from within the strand. */
+    std::deque<packet_ptr_t> writing_packets;
+
+    /** Buffers of the write operation currently in progress.
+    * Only accessed from within the strand. */
+    std::vector<boost::asio::const_buffer> writing_buffers;
+
+    /** Counters of the whole server */
+    ServerStats& server_stats;
+
+    /** Limits for the queued packets, shared by all peers */
+    SendLimits& send_limits;
+
+    /** Counters of this connection, see Statistics.
+    * They are only updated from within the strand, except the pending and
+    * dropped counters.
+    */
+    std::atomic<unsigned long long> messages_in;
+    std::atomic<unsigned long long> messages_out;
+    std::atomic<unsigned long long> bytes_in;
+    std::atomic<unsigned long long> bytes_out;
+    std::atomic<std::size_t> pending_packets;
+    std::atomic<std::size_t> pending_bytes;
+    std::atomic<unsigned long long> dropped_packets;
 
     /** Called when all handlers with a this pointer returned.
     * This function should only be called when all handlers that contain a
     * this pointer (also called "member functions") have returned.
     * In this case, the function signals the enclosing entity via the
     * callback that this object can go out of scope.
+    * If a new reference is created and released meanwhile, it is called
+    * again, possibly on another thread.
     */
     void canDelete();
 
     void postError(const byte_traits::native_string& errmsg);
 
-    static void sendHandler(
-        const boost::system::error_code& e,
-        std::size_t bytes_transferred,
-        ReferenceCounter<RemotePeer>::CountedReference peer_reference,
-        std::shared_ptr<byte_traits::byte_sequence> sendbuf
+    /** Check if a packet would put this peer over its send limits. */
+    bool overSendLimits(std::size_t packet_size) const;
+
+    /** Account for packets that left the send queue */
+    void releasePending(std::size_t packets, std::size_t bytes);
+
+    /** Account for packets that were dropped */
+    void countDropped(std::size_t packets);
+
+    /** Remember that a packet was dropped, so the rest of its message is
+    * dropped as well. Only call this with send_mutex locked.
+    */
+    void dropStream(const SegmentationLayerBase::HeaderType& header);
+
+    /** Check if a packet belongs to a message of which a fragment was
+    * dropped. Only call this with send_mutex locked.
+    */
+    bool inDroppedStream(const SegmentationLayerBase::HeaderType& header);
+
+    /** Report the peer as slow consumer, the server will disconnect it. */
+    static void reportSlowConsumer(
+        HandlerReference peer_reference
     );
 
-    static void rcvHeaderHandler(
-        const boost::system::error_code& error,
+    static void startWrite(
+        HandlerReference peer_reference
+    );
+
+    static void closeSocket(
+        HandlerReference peer_reference
+    );
+
+    static void sendHandler(
+        const boost::system::error_code& e,
         std::size_t bytes_transferred,
-        ReferenceCounter<RemotePeer>::CountedReference peer_reference
+        HandlerReference peer_reference
     );
 
-    static void rcvBodyHandler(
+    static void receiveHandler(
         const boost::system::error_code& error,
         std::size_t bytes_transferred,
-        ReferenceCounter<RemotePeer>::CountedReference peer_reference,
-        std::shared_ptr<byte_traits::byte_sequence> body_data
+        HandlerReference peer_reference
     );
 
     // no copy construction allowed.
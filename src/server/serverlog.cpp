@@ -0,0 +1,195 @@
+// serverlog.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctime>
+#include <thread>
+#include <boost/bind.hpp>
+
+#include "serverlog.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+
+
+static const char* const level_names[] = {
+    "debug", "info", "warning", "error"
+};
+
+static const char* const category_names[] = {
+    "server", "connection", "message"
+};
+
+
+ServerLog::ServerLog(LogLevel min_level_, unsigned max_rate_, std::ostream& out_)
+    : min_level(min_level_), max_rate(max_rate_), out(out_),
+    queue(queue_capacity), dropped(0), running(true)
+{
+    for (RateLimit& limit : limits)
+    {
+        limit.window.store(0, std::memory_order_relaxed);
+        limit.count.store(0, std::memory_order_relaxed);
+        limit.suppressed.store(0, std::memory_order_relaxed);
+    }
+
+    writer_thread = boost::thread(boost::bind(&ServerLog::writerLoop, this));
+}
+
+ServerLog::~ServerLog()
+{
+    running.store(false, std::memory_order_release);
+    writer_thread.join();
+}
+
+void ServerLog::enqueue(
+    LogLevel level,
+    LogCategory category,
+    const char* text,
+    int connection_id,
+    std::string&& detail
+)
+{
+    if (!admit(category))
+        return;
+
+    Record record{
+        level, category, std::chrono::system_clock::now(),
+        text, connection_id, std::move(detail)
+    };
+
+    if (!queue.push(record))
+        dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool ServerLog::admit(LogCategory category)
+{
+    RateLimit& limit = limits[static_cast<int>(category)];
+
+    long long now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+
+    // The first record of a new second resets the count. Records of other
+    // threads may slip in between, so the limit is not exact.
+    long long window = limit.window.load(std::memory_order_relaxed);
+    if (window != now
+        && limit.window.compare_exchange_strong(
+            window, now, std::memory_order_relaxed))
+        limit.count.store(0, std::memory_order_relaxed);
+
+    if (limit.count.fetch_add(1, std::memory_order_relaxed) < max_rate)
+        return true;
+
+    limit.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void ServerLog::writerLoop()
+{
+    std::chrono::steady_clock::time_point last_report =
+        std::chrono::steady_clock::now();
+
+    while (running.load(std::memory_order_acquire))
+    {
+        if (!drain())
+            std::this_thread::sleep_for(
+                std::chrono::milliseconds(poll_interval_ms));
+
+        // summarize losses once per second, so a flood stays a single line
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(1))
+        {
+            reportLosses();
+            last_report = now;
+        }
+    }
+
+    // write what was logged before the destructor was called
+    drain();
+    reportLosses();
+}
+
+bool ServerLog::drain()
+{
+    Record record;
+    bool written = false;
+
+    while (queue.pop(record))
+    {
+        format(record);
+        written = true;
+    }
+
+    // flush once per batch instead of once per record
+    if (written)
+        out.flush();
+
+    return written;
+}
+
+void ServerLog::reportLosses()
+{
+    bool written = false;
+
+    for (int i = 0; i < static_cast<int>(LogCategory::count); ++i)
+    {
+        unsigned long suppressed =
+            limits[i].suppressed.exchange(0, std::memory_order_relaxed);
+
+        if (suppressed)
+        {
+            out<<"[warning] "<<category_names[i]<<": "<<suppressed<<
+                " records suppressed by the rate limit\n";
+            written = true;
+        }
+    }
+
+    unsigned long lost = dropped.exchange(0, std::memory_order_relaxed);
+    if (lost)
+    {
+        out<<"[warning] server: "<<lost<<
+            " records dropped, the log queue was full\n";
+        written = true;
+    }
+
+    if (written)
+        out.flush();
+}
+
+void ServerLog::format(const Record& record)
+{
+    std::time_t time = std::chrono::system_clock::to_time_t(record.time);
+    char timestr[32];
+
+    // only this thread calls localtime, so its static buffer is safe to use
+    if (!std::strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S",
+            std::localtime(&time)))
+        timestr[0] = '\0';
+
+    out<<timestr<<" ["<<level_names[static_cast<int>(record.level)]<<"] "<<
+        category_names[static_cast<int>(record.category)]<<": "<<record.text;
+
+    if (record.connection_id)
+        out<<" (connection "<<record.connection_id<<')';
+
+    if (!record.detail.empty())
+        out<<": "<<record.detail;
+
+    out<<'\n';
+}
@@ -0,0 +1,187 @@
+// serverlog.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SERVERLOG_HPP
+#define SERVERLOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <ostream>
+#include <boost/thread/thread.hpp>
+
+#include "boundedqueue.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** Severity of a log record */
+enum class LogLevel
+{
+    debug,
+    info,
+    warning,
+    error
+};
+
+/** What a log record is about. Every category is rate limited separately. */
+enum class LogCategory
+{
+    server,     /**< The server as a whole */
+    connection, /**< Connecting and disconnecting peers */
+    message,    /**< Messages relayed by the server */
+
+    count       /**< Number of categories, not a category */
+};
+
+/** Asynchronous log of the server.
+*
+* Event loop threads only put a record into a lock free queue, a background
+* thread formats the records and writes them to the output stream. So logging
+* never blocks a handler on a system call.
+*
+* Records below the minimum level are discarded before anything else is done.
+* Every category may only produce a certain number of records per second, the
+* excess records are counted and reported as a summary. Records are dropped as
+* well if the queue is full, that is reported too.
+*
+* This class is thread safe.
+*/
+class ServerLog
+{
+public:
+    /** Constructor, starts the background thread.
+    * @param min_level Records below this level are discarded
+    * @param max_rate Maximum number of records per category and second
+    * @param out Stream the records are written to. Only the background
+    * thread writes to it.
+    */
+    ServerLog(LogLevel min_level, unsigned max_rate, std::ostream& out);
+
+    /** Destructor, writes all pending records and stops the thread. */
+    ~ServerLog();
+
+    /** Check if records of a level would be written.
+    * Use this to avoid building an expensive detail string for nothing.
+    */
+    bool enabled(LogLevel level) const
+    { return level >= min_level; }
+
+    /** Write a record.
+    * @param level Severity of the record
+    * @param category Category of the record
+    * @param text The message. Must be a string literal or live as long as the
+    * log, it is not copied.
+    * @param connection_id Connection the record refers to, 0 for none.
+    * @param detail Additional text that is printed after the message
+    */
+    void write(
+        LogLevel level,
+        LogCategory category,
+        const char* text,
+        int connection_id = 0,
+        std::string detail = std::string()
+    )
+    {
+        if (enabled(level))
+            enqueue(level, category, text, connection_id, std::move(detail));
+    }
+
+private:
+    struct Record
+    {
+        LogLevel level;
+        LogCategory category;
+        std::chrono::system_clock::time_point time;
+        const char* text;
+        int connection_id;
+        std::string detail;
+    };
+
+    /** Counters of the rate limit of one category */
+    struct RateLimit
+    {
+        /** Second the current count belongs to */
+        std::atomic<long long> window;
+
+        /** Number of records admitted in the current second */
+        std::atomic<unsigned> count;
+
+        /** Number of records suppressed since the last report */
+        std::atomic<unsigned long> suppressed;
+    };
+
+    /** Number of records the queue can hold */
+    static constexpr std::size_t queue_capacity = 4096;
+
+    /** Interval in which the background thread looks for new records */
+    static constexpr unsigned poll_interval_ms = 10;
+
+    const LogLevel min_level;
+    const unsigned max_rate;
+    std::ostream& out;
+
+    BoundedQueue<Record> queue;
+
+    RateLimit limits[static_cast<int>(LogCategory::count)];
+
+    /** Number of records dropped because the queue was full */
+    std::atomic<unsigned long> dropped;
+
+    std::atomic<bool> running;
+    boost::thread writer_thread;
+
+    /** Apply the rate limit and put a record into the queue. */
+    void enqueue(
+        LogLevel level,
+        LogCategory category,
+        const char* text,
+        int connection_id,
+        std::string&& detail
+    );
+
+    /** Check the rate limit of a category.
+    * @returns true if the record may be written.
+    */
+    bool admit(LogCategory category);
+
+    /** Main function of the background thread */
+    void writerLoop();
+
+    /** Write all queued records.
+    * @returns true if anything was written
+    */
+    bool drain();
+
+    /** Write summaries of suppressed and dropped records */
+    void reportLosses();
+
+    void format(const Record& record);
+
+    // no copy construction allowed
+    ServerLog(const ServerLog&) = delete;
+    ServerLog& operator= (const ServerLog&) = delete;
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef SERVERLOG_HPP
@@ -0,0 +1,120 @@
+// serverstats.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "serverstats.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+
+
+static const char* const counter_names[] = {
+    "messages in", "messages out", "bytes in", "bytes out",
+    "header errors", "oversized packets",
+    "connections accepted", "connections closed",
+    "dropped packets", "slow consumers", "undeliverable messages",
+    "stray fragments"
+};
+
+
+ServerStats::ServerStats()
+{
+    for (Shard& shard : shards)
+    {
+        for (auto& counter : shard.counters)
+            counter.store(0, std::memory_order_relaxed);
+
+        for (auto& bucket : shard.latency)
+            bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+unsigned ServerStats::nextShardIndex()
+{
+    static std::atomic<unsigned> next_index(0);
+
+    return next_index.fetch_add(1, std::memory_order_relaxed) % shard_count;
+}
+
+void ServerStats::addLatency(std::chrono::steady_clock::duration latency)
+{
+    unsigned long long us =
+        std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+
+    // find the first power of two above the latency
+    unsigned bucket = 0;
+    while (bucket < latency_buckets - 1 && (1ull << bucket) <= us)
+        ++bucket;
+
+    localShard().latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+ServerStats::Snapshot ServerStats::snapshot() const
+{
+    Snapshot snap = {};
+
+    for (const Shard& shard : shards)
+    {
+        for (unsigned i = 0; i < counter_count; ++i)
+            snap.counters[i] +=
+                shard.counters[i].load(std::memory_order_relaxed);
+
+        for (unsigned i = 0; i < latency_buckets; ++i)
+            snap.latency[i] +=
+                shard.latency[i].load(std::memory_order_relaxed);
+    }
+
+    return snap;
+}
+
+unsigned long long
+ServerStats::Snapshot::latencyPercentile(double fraction) const
+{
+    unsigned long long total = 0;
+    for (unsigned long long count : latency)
+        total += count;
+
+    if (!total)
+        return 0;
+
+    // number of samples that must be covered, at least one
+    unsigned long long rank =
+        static_cast<unsigned long long>(fraction * total);
+    if (rank == 0)
+        rank = 1;
+
+    unsigned long long seen = 0;
+    for (unsigned i = 0; i < latency_buckets; ++i)
+    {
+        seen += latency[i];
+        if (seen >= rank)
+            return 1ull << i;
+    }
+
+    return 1ull << (latency_buckets - 1);
+}
+
+void ServerStats::Snapshot::print(std::ostream& os) const
+{
+    for (unsigned i = 0; i < counter_count; ++i)
+        os<<"\n\t"<<counter_names[i]<<": "<<counters[i];
+
+    os<<"\n\tlatency (us): p50 < "<<latencyPercentile(0.5)<<
+        ", p99 < "<<latencyPercentile(0.99)<<
+        ", max < "<<latencyPercentile(1.0);
+}
@@ -0,0 +1,134 @@
+// serverstats.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SERVERSTATS_HPP
+#define SERVERSTATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** Counters of the whole server.
+*
+* The counters are updated by all event loop threads. To keep them from
+* fighting over the same cache lines, every thread updates its own shard of
+* counters. A snapshot adds up the shards.
+*
+* This class is thread safe.
+*/
+class ServerStats
+{
+public:
+    /** The counters */
+    enum Counter
+    {
+        messages_in,            /**< Packets received */
+        messages_out,           /**< Packets written to peers */
+        bytes_in,               /**< Bytes received */
+        bytes_out,              /**< Bytes written to peers */
+        header_errors,          /**< Packets with an invalid header */
+        oversized_packets,      /**< Packets exceeding the maximum size */
+        connections_accepted,   /**< Connections accepted */
+        connections_closed,     /**< Connections removed */
+        dropped_packets,        /**< Packets dropped for slow consumers */
+        slow_consumers,         /**< Peers disconnected for being too slow */
+        undeliverable,          /**< Messages to users that are not here */
+        stray_fragments,        /**< Fragments of unknown messages */
+
+        counter_count           /**< Number of counters, not a counter */
+    };
+
+    /** Number of buckets of the latency histogram.
+    * Bucket i counts latencies below 2^i microseconds, the last bucket
+    * counts everything else.
+    */
+    static constexpr unsigned latency_buckets = 24;
+
+    /** Sums of all counters at one point in time */
+    struct Snapshot
+    {
+        unsigned long long counters[counter_count];
+        unsigned long long latency[latency_buckets];
+
+        /** Return the upper bound of the latency of a fraction of the
+        * packets, in microseconds.
+        * @param fraction Value between 0 and 1, e.g. 0.99 for the 99th
+        * percentile
+        */
+        unsigned long long latencyPercentile(double fraction) const;
+
+        /** Write the counters in a human readable form */
+        void print(std::ostream& os) const;
+    };
+
+    ServerStats();
+
+    /** Add to a counter */
+    void add(Counter counter, unsigned long long value = 1)
+    {
+        localShard().counters[counter].fetch_add(
+            value, std::memory_order_relaxed);
+    }
+
+    /** Record the time from the reception of a packet until it was written
+    * to a peer.
+    */
+    void addLatency(std::chrono::steady_clock::duration latency);
+
+    /** Add up the counters of all shards */
+    Snapshot snapshot() const;
+
+private:
+    /** Size of a cache line */
+    static constexpr std::size_t cache_line_size = 64;
+
+    /** Number of shards. Threads share a shard if there are more threads. */
+    static constexpr unsigned shard_count = 16;
+
+    struct alignas(cache_line_size) Shard
+    {
+        std::atomic<unsigned long long> counters[counter_count];
+        std::atomic<unsigned long long> latency[latency_buckets];
+    };
+
+    Shard shards[shard_count];
+
+    /** Return the shard of the calling thread */
+    Shard& localShard()
+    {
+        static thread_local unsigned shard_index = nextShardIndex();
+        return shards[shard_index];
+    }
+
+    static unsigned nextShardIndex();
+
+    // no copy construction allowed
+    ServerStats(const ServerStats&) = delete;
+    ServerStats& operator= (const ServerStats&) = delete;
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef SERVERSTATS_HPP
@@ -24,6 +24,7 @@
 #include <boost/function.hpp>
 
 #include "msglayer.hpp"
+#include "packet.hpp"
 
 namespace nuke_ms
 {
@@ -90,10 +91,13 @@ struct ServerEvent1Parm : public BasicServerEvent
     virtual ~ServerEvent1Parm() {}
 };
 
-/** Typedef for received message. */
+/** Typedef for received message.
+* The packet still contains the header as it was received, so it can be
+* relayed as it is.
+*/
 typedef ServerEvent1Parm<
         BasicServerEvent::ID_MSG_RECEIVED,
-        std::shared_ptr<SegmentationLayer<SerializedData>>
+        Packet::ptr_t
     > ReceivedMessageEvent;
 
 /** Typedef for Disconnection events. */
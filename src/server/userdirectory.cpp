@@ -0,0 +1,79 @@
+// userdirectory.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "userdirectory.hpp"
+
+using namespace nuke_ms;
+using namespace server;
+
+
+void UserDirectory::registerConnection(
+    connection_id_t connection_id,
+    UniqueUserID user
+)
+{
+    boost::unique_lock<boost::shared_mutex> lock(directory_mutex);
+
+    auto it = connection_users.find(connection_id);
+    if (it != connection_users.end())
+    {
+        if (it->second == user.id)
+            return;
+
+        removeFromUser(connection_id, it->second);
+        it->second = user.id;
+    }
+    else
+        connection_users.insert(std::make_pair(connection_id, user.id));
+
+    user_connections[user.id].push_back(connection_id);
+}
+
+void UserDirectory::unregisterConnection(connection_id_t connection_id)
+{
+    boost::unique_lock<boost::shared_mutex> lock(directory_mutex);
+
+    auto it = connection_users.find(connection_id);
+    if (it == connection_users.end())
+        return;
+
+    removeFromUser(connection_id, it->second);
+    connection_users.erase(it);
+}
+
+void UserDirectory::removeFromUser(
+    connection_id_t connection_id,
+    decltype(UniqueUserID::id) user
+)
+{
+    auto it = user_connections.find(user);
+    if (it == user_connections.end())
+        return;
+
+    std::vector<connection_id_t>& connections = it->second;
+    connections.erase(
+        std::remove(connections.begin(), connections.end(), connection_id),
+        connections.end()
+    );
+
+    if (connections.empty())
+        user_connections.erase(it);
+}
@@ -0,0 +1,102 @@
+// userdirectory.hpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef USERDIRECTORY_HPP
+#define USERDIRECTORY_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <boost/thread/shared_mutex.hpp>
+
+#include "neartypes.hpp"
+#include "servevent.hpp"
+
+namespace nuke_ms
+{
+namespace server
+{
+
+/** Index of the connections of every user.
+*
+* A user may be connected several times, a connection belongs to at most one
+* user. The server learns the user of a connection from the sender field of
+* the messages it sends, there is no authentication.
+*
+* This class is thread safe. Lookups may run concurrently, changes are
+* exclusive.
+*/
+class UserDirectory
+{
+public:
+    typedef BasicServerEvent::connection_id_t connection_id_t;
+
+    /** Register a connection for a user.
+    * If the connection was registered for another user before, it is moved
+    * to the new user.
+    */
+    void registerConnection(connection_id_t connection_id, UniqueUserID user);
+
+    /** Remove a connection from the directory, if it was registered. */
+    void unregisterConnection(connection_id_t connection_id);
+
+    /** Call a function for every connection of a user.
+    * The directory is locked while the function runs, so it must not change
+    * the directory.
+    * @returns The number of connections of the user.
+    */
+    template <typename Function>
+    std::size_t forEachConnection(UniqueUserID user, Function f) const
+    {
+        boost::shared_lock<boost::shared_mutex> lock(directory_mutex);
+
+        auto it = user_connections.find(user.id);
+        if (it == user_connections.end())
+            return 0;
+
+        for (connection_id_t connection_id : it->second)
+            f(connection_id);
+
+        return it->second.size();
+    }
+
+private:
+    /** Connections of every user. The lists are short, usually one entry. */
+    std::unordered_map<
+        decltype(UniqueUserID::id), std::vector<connection_id_t>
+    > user_connections;
+
+    /** User of every registered connection */
+    std::unordered_map<connection_id_t, decltype(UniqueUserID::id)>
+        connection_users;
+
+    mutable boost::shared_mutex directory_mutex;
+
+    /** Remove a connection from the list of a user.
+    * The caller must hold the exclusive lock.
+    */
+    void removeFromUser(
+        connection_id_t connection_id,
+        decltype(UniqueUserID::id) user
+    );
+};
+
+} // namespace server
+} // namespace nuke_ms
+
+#endif // ifndef USERDIRECTORY_HPP
@@ -33,7 +33,7 @@ namespace nuke_ms { namespace servnode {
 struct SendHandler
 {
     std::shared_ptr<ConnectedClient> parent;
-    std::shared_ptr<byte_traits::byte_sequence> buffer;
+    std::size_t bytes_expected;
 
     void operator() (
         const boost::system::error_code& error,
@@ -41,32 +41,9 @@ struct SendHandler
     );
 };
 
-struct ReceiveHeaderHandler
+struct ReceiveHandler
 {
     std::shared_ptr<ConnectedClient> parent;
-    std::shared_ptr<byte_traits::byte_t> buffer;
-
-    ReceiveHeaderHandler(std::shared_ptr<ConnectedClient> parent_)
-        : parent(parent_),
-        buffer(make_shared_array<
-            byte_traits::byte_t, SegmentationLayerBase::header_length
-        >())
-    {}
-
-    ReceiveHeaderHandler(const ReceiveHeaderHandler& other) = default;
-
-    ReceiveHeaderHandler(ReceiveHeaderHandler&& other) = default;
-
-    void operator() (
-        const boost::system::error_code& error,
-        std::size_t bytes_transferred
-    );
-};
-
-struct ReceiveBodyHandler
-{
-    std::shared_ptr<ConnectedClient> parent;
-    std::shared_ptr<const byte_traits::byte_sequence> buffer;
 
     void operator() (
         const boost::system::error_code& error,
@@ -82,16 +59,52 @@ ConnectedClient::ConnectedClient(
     boost::asio::ip::tcp::socket&& socket_,
     boost::asio::io_service& io_service_
 ) : connection_id(connection_id_), io_service(io_service_),
-    socket(std::move(socket_))
+    socket(std::move(socket_)), write_in_progress(false),
+    shutdown_requested(false), reader(SegmentationLayerBase::default_max_packetsize),
+    next_stream_id(0)
 { }
 
 void
-ConnectedClient::async_write(std::shared_ptr<byte_traits::byte_sequence> data)
+ConnectedClient::async_write(std::shared_ptr<const GatherBuffers> data)
 {
+    {
+        boost::mutex::scoped_lock lock(send_mutex);
+        send_queue.push_back(std::move(data));
+
+        // the running write will pick up the packet when it has completed
+        if (write_in_progress)
+            return;
+
+        write_in_progress = true;
+    }
+
+    startWrite();
+}
+
+void ConnectedClient::startWrite()
+{
+    // take all queued packets
+    {
+        boost::mutex::scoped_lock lock(send_mutex);
+        writing_packets.swap(send_queue);
+    }
+
+    // gather the buffers of all packets into one sequence
+    std::vector<boost::asio::const_buffer> buffers;
+    buffers.reserve(writing_packets.size() * 2);
+    std::size_t bytes_expected = 0;
+
+    for (const auto& packet : writing_packets)
+    {
+        GatherBuffers::const_buffers_type bufs = packet->buffers();
+        buffers.insert(buffers.end(), bufs.begin(), bufs.end());
+        bytes_expected += packet->size();
+    }
+
     boost::asio::async_write(
         socket,
-        boost::asio::buffer(*data),
-        SendHandler{shared_from_this(), data}
+        buffers,
+        SendHandler{shared_from_this(), bytes_expected}
     );
 }
 
@@ -139,18 +152,30 @@ ConnectedClient::~ConnectedClient()
 
 void ConnectedClient::startReceive()
 {
-    ReceiveHeaderHandler handler{shared_from_this()};
-
-    async_read(
-        socket,
-        boost::asio::buffer(
-            handler.buffer.get(),
-            SegmentationLayerBase::header_length),
-        std::move(handler)
+    // read whatever is available, the packets are split up afterwards
+    socket.async_read_some(
+        reader.prepare(),
+        ReceiveHandler{shared_from_this()}
     );
 }
 
 void ConnectedClient::shutdown()
+{
+    {
+        boost::mutex::scoped_lock lock(send_mutex);
+
+        // let the running write finish first, its handler will shut down
+        if (write_in_progress)
+        {
+            shutdown_requested = true;
+            return;
+        }
+    }
+
+    shutdownNow();
+}
+
+void ConnectedClient::shutdownNow()
 {
     // initiate socket shutdown
     boost::system::error_code dontcare;
@@ -162,15 +187,46 @@ void SendHandler::operator() (
     std::size_t bytes_transferred
 )
 {
+    // the written packets are not needed anymore
+    parent->writing_packets.clear();
+
     // on error, disconnect parent
-    if (error || bytes_transferred != buffer->size())
+    if (error || bytes_transferred != bytes_expected)
     {
-        parent->shutdown();
+        {
+            boost::mutex::scoped_lock lock(parent->send_mutex);
+            parent->send_queue.clear();
+            parent->write_in_progress = false;
+        }
+
+        parent->shutdownNow();
         parent->signals.disconnected(parent);
+        return;
     }
+
+    // write everything that was queued in the meantime
+    bool write_more;
+    {
+        boost::mutex::scoped_lock lock(parent->send_mutex);
+        write_more = !parent->send_queue.empty();
+
+        if (!write_more)
+        {
+            parent->write_in_progress = false;
+
+            // nothing else to do, unless a shutdown was requested
+            if (!parent->shutdown_requested)
+                return;
+        }
+    }
+
+    if (write_more)
+        parent->startWrite();
+    else
+        parent->shutdownNow();
 }
 
-void ReceiveHeaderHandler::operator() (
+void ReceiveHandler::operator() (
     const boost::system::error_code& error,
     std::size_t bytes_transferred
 )
@@ -178,59 +234,37 @@ void ReceiveHeaderHandler::operator() (
     // if we had an error reading, shutdown and send disconnected event
     if (error)
     {
-        parent->shutdown();
+        parent->shutdownNow();
         parent->signals.disconnected(parent);
+        return;
     }
 
+    parent->reader.commit(bytes_transferred);
+
     try
     {
-        // decode and verify the header of the message
-        SegmentationLayerBase::HeaderType header_data
-            = SegmentationLayerBase::decodeHeader(buffer.get());
-
-/// @todo FIXME Magic number, set to something proper or make configurable
-constexpr byte_traits::uint2b_t MAX_PACKETSIZE = 0x8FFF;
-
-        if (header_data.packetsize > MAX_PACKETSIZE)
-            throw MsgLayerError("Oversized packet.");
-
-        auto body_buf = std::make_shared<byte_traits::byte_sequence>(
-            header_data.packetsize - SegmentationLayerBase::header_length
-        );
-
-        // start an asynchronous receive for the body
-        async_read(
-            parent->socket,
-            boost::asio::buffer(*body_buf),
-            ReceiveBodyHandler{parent, body_buf}
-        );
+        // send a signal for every complete packet that was received
+        SerializedData packet({}, {}, 0), message({}, {}, 0);
+        while (parent->reader.nextPacket(packet))
+        {
+            // fragments are collected until their message is complete
+            if (!parent->assembler.addPacket(packet, message))
+                continue;
+
+            parent->signals.receivedMessage(
+                parent,
+                std::make_shared<SerializedData>(std::move(message))
+            );
+        }
     }
     // on failure, shutdown and send disconnected event
     catch (const MsgLayerError& e)
     {
-        parent->shutdown();
-        parent->signals.disconnected(parent);
-    }
-}
-
-void ReceiveBodyHandler::operator() (
-    const boost::system::error_code& error,
-    std::size_t bytes_transferred
-)
-{
-    // if we had an error reading, shutdown and send disconnected event
-    if (error)
-    {
-        parent->shutdown();
+        parent->shutdownNow();
         parent->signals.disconnected(parent);
+        return;
     }
 
-    // otherwise, construct message and send signal
-    parent->signals.receivedMessage(
-        parent,
-        std::make_shared<SerializedData>(buffer, buffer->begin(),buffer->size())
-    );
-
     // restart receive operation
     parent->startReceive();
 }
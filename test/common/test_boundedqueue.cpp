@@ -0,0 +1,124 @@
+// test_boundedqueue.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <stdexcept>
+
+#include "boundedqueue.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class BoundedQueue")
+
+using namespace nuke_ms;
+
+int main()
+{
+    // the capacity must be a power of two
+    bool thrown = false;
+    try {
+        BoundedQueue<int> invalid(6);
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    TEST_ASSERT(thrown);
+
+    // elements come out in the order they were put in
+    BoundedQueue<std::string> queue(4);
+    TEST_ASSERT(queue.capacity() == 4);
+
+    std::string value;
+    TEST_ASSERT(!queue.pop(value));
+
+    const char* const words[] = {"one", "two", "three", "four"};
+    for (const char* word : words)
+    {
+        value = word;
+        TEST_ASSERT(queue.push(value));
+    }
+
+    // a full queue rejects the element and leaves it alone
+    value = "five";
+    TEST_ASSERT(!queue.push(value));
+    TEST_ASSERT(value == "five");
+
+    for (const char* word : words)
+        TEST_ASSERT(queue.pop(value) && value == word);
+    TEST_ASSERT(!queue.pop(value));
+
+    // wrap around several times
+    for (int round = 0; round < 100; ++round)
+    {
+        value = std::to_string(round);
+        TEST_ASSERT(queue.push(value));
+        TEST_ASSERT(queue.pop(value) && value == std::to_string(round));
+    }
+
+    // several producers and one consumer: every element arrives exactly once
+    const int producer_count = 4;
+    const int per_producer = 100000;
+
+    BoundedQueue<int> shared_queue(256);
+    std::vector<std::thread> producers;
+
+    for (int p = 0; p < producer_count; ++p)
+        producers.emplace_back([&shared_queue, p, per_producer]() {
+            for (int i = 0; i < per_producer; ++i)
+            {
+                int element = p * per_producer + i;
+                while (!shared_queue.push(element))
+                    std::this_thread::yield();
+            }
+        });
+
+    std::vector<int> last(producer_count, -1);
+    bool in_order = true;
+
+    for (int received = 0; received < producer_count * per_producer;)
+    {
+        int element;
+        if (!shared_queue.pop(element))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // the elements of one producer keep their order
+        int p = element / per_producer;
+        if (element % per_producer != last[p] + 1)
+            in_order = false;
+        last[p] = element % per_producer;
+
+        ++received;
+    }
+
+    for (std::thread& producer : producers)
+        producer.join();
+
+    TEST_ASSERT(in_order);
+    for (int p = 0; p < producer_count; ++p)
+        TEST_ASSERT(last[p] == per_producer - 1);
+
+    int element;
+    TEST_ASSERT(!shared_queue.pop(element));
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,89 @@
+// test_bufferpool.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "bufferpool.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class BufferPool")
+
+using namespace nuke_ms;
+
+int main()
+{
+    auto pool = std::make_shared<BufferPool>(2);
+
+    // buffers are at least as big as requested
+    for (std::size_t size : {0, 1, 63, 64, 65, 1000, 0x8FFF, 0x10000})
+    {
+        BufferPool::buffer_ptr_t buffer = pool->acquire(size);
+        TEST_ASSERT(buffer && buffer->size() >= size);
+    }
+
+    // a released buffer is handed out again, its contents are not touched
+    {
+        BufferPool::buffer_ptr_t buffer = pool->acquire(100);
+        byte_traits::byte_sequence* address = buffer.get();
+        (*buffer)[0] = 0xAB;
+        buffer.reset();
+
+        buffer = pool->acquire(120);
+        TEST_ASSERT(buffer.get() == address);
+        TEST_ASSERT((*buffer)[0] == 0xAB);
+
+        // a buffer of a different size class is a different buffer
+        BufferPool::buffer_ptr_t other = pool->acquire(1000);
+        TEST_ASSERT(other.get() != address);
+    }
+
+    // recycled buffers are not counted as allocations
+    {
+        BufferPool::Statistics before = pool->statistics();
+
+        pool->acquire(100).reset();
+        pool->acquire(100).reset();
+
+        BufferPool::Statistics after = pool->statistics();
+        TEST_ASSERT(after.acquired == before.acquired + 2);
+        TEST_ASSERT(after.allocated == before.allocated);
+    }
+
+    // buffers that are too big are not pooled
+    {
+        std::size_t size = BufferPool::max_class_size + 1;
+        BufferPool::buffer_ptr_t buffer = pool->acquire(size);
+        TEST_ASSERT(buffer->size() == size);
+    }
+
+    // buffers that outlive their pool are still valid, and keep the pool
+    // alive until they are destroyed
+    {
+        BufferPool::buffer_ptr_t buffer = pool->acquire(10);
+        std::weak_ptr<BufferPool> weak_pool = pool;
+        pool.reset();
+
+        TEST_ASSERT(!weak_pool.expired());
+        (*buffer)[9] = 0xCD;
+        buffer.reset();
+        TEST_ASSERT(weak_pool.expired());
+    }
+
+    return CONCLUDE_TEST();
+}
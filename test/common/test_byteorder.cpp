@@ -88,6 +88,31 @@ int main()
         '\t'<<"Reversed: "<<hexprint(&sshort_reverse, &sshort_reverse+1)<<'\n'<<
         '\t'<<"to_netbo: "<<hexprint(&sshort_to_netbo,&sshort_to_netbo+1)<<'\n';
 
+    // sequences are written least significant byte first, both with the bulk
+    // copy and the value by value conversion
+    const byte_traits::uint2b_t ushorts[] = {0x1122, 0x3344};
+    const byte_traits::byte_t ushorts_netbo[] = {0x22, 0x11, 0x44, 0x33};
+
+    byte_traits::byte_sequence seq(sizeof(ushorts));
+    nuke_ms::writesequence(seq.begin(), ushorts, 2);
+    TEST_ASSERT(std::equal(seq.begin(), seq.end(), ushorts_netbo));
+
+    byte_traits::byte_sequence seq_conv(sizeof(ushorts));
+    nuke_ms::detail::writesequence(
+        seq_conv.begin(), ushorts, 2, std::false_type());
+    TEST_ASSERT(seq_conv == seq);
+
+    byte_traits::uint2b_t ushorts_read[2];
+    nuke_ms::readsequence(ushorts_read, 2, seq.begin());
+    TEST_ASSERT(std::equal(ushorts, ushorts + 2, ushorts_read));
+
+    byte_traits::uint2b_t ushorts_read_conv[2];
+    nuke_ms::detail::readsequence(
+        ushorts_read_conv, 2, seq.begin(), std::false_type());
+    TEST_ASSERT(std::equal(ushorts, ushorts + 2, ushorts_read_conv));
+
+    std::cout<<"Sequence of unsigned shorts: "<<
+        hexprint(seq.begin(), seq.end())<<'\n';
 
     return CONCLUDE_TEST();
 }
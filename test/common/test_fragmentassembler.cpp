@@ -0,0 +1,197 @@
+// test_fragmentassembler.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "fragmentassembler.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class FragmentAssembler")
+
+using namespace nuke_ms;
+
+// split a payload of size bytes, counting up from first, into packets
+static byte_traits::byte_sequence segmentPayload(
+    std::size_t size,
+    byte_traits::byte_t first,
+    std::size_t max_packetsize,
+    SegmentationLayerBase::stream_id_t stream_id
+)
+{
+    byte_traits::byte_sequence buffer(
+        SegmentationLayerBase::segmentedSize(size, max_packetsize));
+
+    std::size_t offset = buffer.size() - size;
+    for (std::size_t i = 0; i < size; ++i)
+        buffer[offset + i] = static_cast<byte_traits::byte_t>(first + i);
+
+    SegmentationLayerBase::segmentInPlace(
+        buffer, size, max_packetsize, stream_id);
+
+    return buffer;
+}
+
+// return the packets in a segmented buffer
+static std::vector<SerializedData> splitPackets(
+    const byte_traits::byte_sequence& buffer
+)
+{
+    auto data = std::make_shared<byte_traits::byte_sequence>(buffer);
+    std::vector<SerializedData> packets;
+
+    for (std::size_t pos = 0; pos < data->size(); )
+    {
+        std::size_t size =
+            SegmentationLayerBase::decodeHeader(data->begin() + pos).packetsize;
+        packets.push_back(SerializedData(data, data->begin() + pos, size));
+        pos += size;
+    }
+
+    return packets;
+}
+
+static bool checkPayload(
+    const SerializedData& message,
+    std::size_t size,
+    byte_traits::byte_t first
+)
+{
+    if (message.size() != size)
+        return false;
+
+    for (std::size_t i = 0; i < size; ++i)
+        if (*(message.begin() + i) != static_cast<byte_traits::byte_t>(first + i))
+            return false;
+
+    return true;
+}
+
+int main()
+{
+    // a payload that fits is not fragmented
+    {
+        std::vector<SerializedData> packets =
+            splitPackets(segmentPayload(50, 1, 100, 1));
+        TEST_ASSERT(packets.size() == 1);
+
+        FragmentAssembler assembler;
+        SerializedData message({}, {}, 0);
+        TEST_ASSERT(assembler.addPacket(packets[0], message));
+        TEST_ASSERT(checkPayload(message, 50, 1));
+    }
+
+    // a large payload is split into fragments of at most max_packetsize
+    // bytes, interleaved with another message they are put back together
+    {
+        std::vector<SerializedData> big =
+            splitPackets(segmentPayload(1000, 7, 100, 1));
+        std::vector<SerializedData> other =
+            splitPackets(segmentPayload(150, 3, 100, 2));
+        std::vector<SerializedData> small =
+            splitPackets(segmentPayload(20, 5, 100, 3));
+
+        TEST_ASSERT(big.size() == 12);
+        TEST_ASSERT(other.size() == 2);
+        for (const SerializedData& packet : big)
+            TEST_ASSERT(packet.size() <= 100);
+
+        FragmentAssembler assembler;
+        SerializedData message({}, {}, 0);
+        unsigned completed = 0;
+
+        for (std::size_t i = 0; i < big.size(); ++i)
+        {
+            if (i < other.size() && assembler.addPacket(other[i], message))
+            {
+                TEST_ASSERT(checkPayload(message, 150, 3));
+                ++completed;
+            }
+
+            if (i == 5)
+            {
+                TEST_ASSERT(assembler.addPacket(small[0], message));
+                TEST_ASSERT(checkPayload(message, 20, 5));
+            }
+
+            bool complete = assembler.addPacket(big[i], message);
+            TEST_ASSERT(complete == (i == big.size() - 1));
+            if (complete)
+            {
+                TEST_ASSERT(checkPayload(message, 1000, 7));
+                ++completed;
+            }
+        }
+
+        TEST_ASSERT(completed == 2);
+    }
+
+    // fragments of a message whose beginning was missed are discarded
+    {
+        std::vector<SerializedData> big =
+            splitPackets(segmentPayload(300, 0, 100, 9));
+
+        FragmentAssembler assembler;
+        SerializedData message({}, {}, 0);
+        for (std::size_t i = 1; i < big.size(); ++i)
+            TEST_ASSERT(!assembler.addPacket(big[i], message));
+    }
+
+    // messages exceeding the limit are rejected
+    {
+        std::vector<SerializedData> big =
+            splitPackets(segmentPayload(1000, 0, 100, 4));
+
+        FragmentAssembler assembler(500);
+        SerializedData message({}, {}, 0);
+        bool caught = false;
+        try {
+            for (const SerializedData& packet : big)
+                assembler.addPacket(packet, message);
+        }
+        catch (const OversizedPacketError&)
+        {
+            caught = true;
+        }
+        TEST_ASSERT(caught);
+    }
+
+    // fragment flags without a stream identifier are invalid
+    {
+        byte_traits::byte_sequence header(
+            SegmentationLayerBase::v1_header_length);
+        SegmentationLayerBase::HeaderType invalid = {
+            1, SegmentationLayerBase::FLAG_MORE,
+            SegmentationLayerBase::v1_header_length, 0
+        };
+        SegmentationLayerBase::encodeHeader(header.begin(), invalid);
+
+        bool caught = false;
+        try {
+            SegmentationLayerBase::decodeHeader(header.begin());
+        }
+        catch (const InvalidHeaderError&)
+        {
+            caught = true;
+        }
+        TEST_ASSERT(caught);
+    }
+
+    return CONCLUDE_TEST();
+}
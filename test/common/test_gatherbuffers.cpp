@@ -0,0 +1,134 @@
+// test_gatherbuffers.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <stdexcept>
+
+#include "neartypes.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class GatherBuffers")
+
+using namespace nuke_ms;
+
+/** Concatenate the buffers */
+static byte_traits::byte_sequence flatten(const GatherBuffers& buffers)
+{
+    byte_traits::byte_sequence data;
+
+    for (const boost::asio::const_buffer& buf : buffers.buffers())
+    {
+        auto begin = static_cast<const byte_traits::byte_t*>(buf.data());
+        data.insert(data.end(), begin, begin + buf.size());
+    }
+
+    return data;
+}
+
+/** Serialize a message the contiguous way */
+template <typename Message>
+static byte_traits::byte_sequence serialize(const Message& msg)
+{
+    byte_traits::byte_sequence data(msg.size());
+    msg.fillSerialized(data.begin());
+
+    return data;
+}
+
+int main()
+{
+    // the buffers of a user message match the serialized message, the
+    // headers are merged and the string is referenced
+    {
+        SegmentationLayer<NearUserMessage> packet{NearUserMessage(
+            StringwrapLayer("hello gathering world"),
+            UniqueUserID(0x0102030405060708ull), UniqueUserID(42ull), 7)};
+
+        GatherBuffers buffers;
+        packet.fillBuffers(buffers);
+
+        TEST_ASSERT(buffers.size() == packet.size());
+        TEST_ASSERT(buffers.count() == 2);
+        TEST_ASSERT(flatten(buffers) == serialize(packet));
+        TEST_ASSERT((buffers.buffers().begin() + 1)->data() ==
+            packet._inner_layer._stringwrap._message_string.data());
+    }
+
+    // a large message gets a version 1 header
+    {
+        SegmentationLayer<ChannelMessage> packet{ChannelMessage(
+            ChannelMessage::OP_PUBLISH, 12345,
+            StringwrapLayer(std::string(70000, 'x')), UniqueUserID(9ull), 3)};
+
+        GatherBuffers buffers;
+        packet.fillBuffers(buffers);
+
+        TEST_ASSERT(buffers.size() == packet.size());
+        TEST_ASSERT(flatten(buffers) == serialize(packet));
+    }
+
+    // serialized data is referenced in its memory block, empty messages
+    // take no payload buffer
+    {
+        auto block = std::make_shared<byte_traits::byte_sequence>(100, 0xAB);
+        SegmentationLayer<SerializedData> packet{
+            SerializedData(block, block->begin() + 10, 50)};
+
+        GatherBuffers buffers;
+        packet.fillBuffers(buffers);
+
+        TEST_ASSERT(flatten(buffers) == serialize(packet));
+        TEST_ASSERT((buffers.buffers().begin() + 1)->data() ==
+            &*(block->begin() + 10));
+
+        SegmentationLayer<StringwrapLayer> empty{StringwrapLayer()};
+        GatherBuffers empty_buffers;
+        empty.fillBuffers(empty_buffers);
+
+        TEST_ASSERT(empty_buffers.count() == 1);
+        TEST_ASSERT(flatten(empty_buffers) == serialize(empty));
+    }
+
+    // the gathered message is kept alive with its buffers
+    {
+        std::shared_ptr<const GatherBuffers> buffers = gatherMessage(
+            SegmentationLayer<StringwrapLayer>{StringwrapLayer("kept")});
+
+        byte_traits::byte_sequence expected = serialize(
+            SegmentationLayer<StringwrapLayer>{StringwrapLayer("kept")});
+        TEST_ASSERT(flatten(*buffers) == expected);
+    }
+
+    // the header space is limited
+    {
+        GatherBuffers buffers;
+        buffers.appendHeader(GatherBuffers::header_capacity);
+
+        bool thrown = false;
+        try {
+            buffers.appendHeader(1);
+        } catch (const std::length_error&) {
+            thrown = true;
+        }
+        TEST_ASSERT(thrown);
+    }
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,98 @@
+// test_messagearena.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdint>
+#include <vector>
+
+#include "messagearena.hpp"
+#include "neartypes.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class MessageArena")
+
+using namespace nuke_ms;
+
+struct Counted
+{
+    static int alive;
+    double value;
+
+    explicit Counted(double value_) : value(value_) { ++alive; }
+    ~Counted() { --alive; }
+};
+
+int Counted::alive = 0;
+
+int main()
+{
+    // objects are created in the arena and outlive it
+    {
+        std::shared_ptr<Counted> a, b;
+        {
+            MessageArena arena;
+            a = arena.makeShared<Counted>(1.5);
+            b = arena.makeShared<Counted>(2.5);
+        }
+
+        TEST_ASSERT(Counted::alive == 2);
+        TEST_ASSERT(a->value == 1.5 && b->value == 2.5);
+        TEST_ASSERT(reinterpret_cast<std::uintptr_t>(a.get())
+            % alignof(Counted) == 0);
+
+        a.reset();
+        TEST_ASSERT(Counted::alive == 1);
+        b.reset();
+        TEST_ASSERT(Counted::alive == 0);
+    }
+
+    // the block is recycled by the pool once every object is gone
+    {
+        MessageArena().makeShared<Counted>(0.0).reset();
+
+        BufferPool::Statistics before = BufferPool::instance()->statistics();
+
+        for (int i = 0; i < 10; ++i)
+        {
+            auto msg = MessageArena().makeShared<NearUserMessage>(
+                StringwrapLayer("hello"), UniqueUserID(1ull), UniqueUserID(2ull));
+            TEST_ASSERT(msg->_stringwrap._message_string == "hello");
+        }
+
+        BufferPool::Statistics after = BufferPool::instance()->statistics();
+        TEST_ASSERT(after.acquired == before.acquired + 10);
+        TEST_ASSERT(after.allocated == before.allocated);
+    }
+
+    // allocations that don't fit into the block come from the heap
+    {
+        MessageArena arena(16);
+        std::vector<int, ArenaAllocator<int>> numbers(arena.allocator<int>());
+
+        for (int i = 0; i < 1000; ++i)
+            numbers.push_back(i);
+
+        bool correct = true;
+        for (int i = 0; i < 1000; ++i)
+            correct = correct && numbers[i] == i;
+        TEST_ASSERT(correct);
+    }
+
+    return CONCLUDE_TEST();
+}
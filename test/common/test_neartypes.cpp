@@ -88,5 +88,73 @@ int main()
         TEST_ASSERT(no_exception_thrown);
     }
 
+    // the view reads the same fields without copying the string
+    {
+        auto block = std::make_shared<byte_traits::byte_sequence>(bytes);
+        NearUserMessageView view(
+            SerializedData(block, block->begin(), block->size()));
+
+        TEST_ASSERT(NearUserMessageView::isUserMessage(view.data()));
+        TEST_ASSERT(view.msg_id() == NearUserMessage::msg_id_t(0xF0));
+        TEST_ASSERT(view.recipient() == recipient);
+        TEST_ASSERT(view.sender() == sender);
+        TEST_ASSERT(view.body() == message_string);
+        TEST_ASSERT(view.body().data() == reinterpret_cast<const char*>(
+            &*(block->begin() + NearUserMessage::header_length)));
+        TEST_ASSERT(view.decode()._stringwrap._message_string
+            == message_string);
+
+        // too short for the header
+        bool thrown = false;
+        try {
+            NearUserMessageView wrong(
+                SerializedData(block, block->begin(), 3));
+        } catch (const UndersizedPacketError&) {
+            thrown = true;
+        }
+        TEST_ASSERT(thrown);
+    }
+
+    // channel messages survive a round trip
+    {
+        ChannelMessage publish(
+            ChannelMessage::OP_PUBLISH,
+            0xC0FFEE,
+            StringwrapLayer(message_string),
+            sender,
+            ChannelMessage::msg_id_t(7)
+        );
+
+        std::vector<byte_traits::byte_t> channel_bytes(publish.size());
+        publish.fillSerialized(channel_bytes.begin());
+        SerializedData channel_data(
+            {}, channel_bytes.begin(), channel_bytes.size());
+
+        ChannelMessage::operation_t operation;
+        ChannelMessage::channel_id_t channel;
+        TEST_ASSERT(ChannelMessage::peekHeader(channel_data, operation, channel));
+        TEST_ASSERT(operation == ChannelMessage::OP_PUBLISH);
+        TEST_ASSERT(channel == 0xC0FFEE);
+
+        ChannelMessage up(channel_data);
+        TEST_ASSERT(up._operation == ChannelMessage::OP_PUBLISH);
+        TEST_ASSERT(up._channel == 0xC0FFEE);
+        TEST_ASSERT(up._sender == sender);
+        TEST_ASSERT(up._msg_id == 7);
+        TEST_ASSERT(up._stringwrap._message_string == message_string);
+
+        // a user message is not a channel message
+        TEST_ASSERT(!ChannelMessage::peekHeader(serdat, operation, channel));
+        TEST_ASSERT(!NearUserMessageView::isUserMessage(channel_data));
+
+        bool thrown = false;
+        try {
+            ChannelMessage wrong(serdat);
+        } catch (const InvalidHeaderError&) {
+            thrown = true;
+        }
+        TEST_ASSERT(thrown);
+    }
+
     return CONCLUDE_TEST();
 }
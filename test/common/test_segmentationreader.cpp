@@ -0,0 +1,181 @@
+// test_segmentationreader.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include "segmentationreader.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class SegmentationStreamReader")
+
+using namespace nuke_ms;
+
+// serialize a packet whose body consists of size bytes with the value fill
+static void appendPacket(
+    byte_traits::byte_sequence& stream,
+    std::size_t size,
+    byte_traits::byte_t fill
+)
+{
+    auto body = std::make_shared<byte_traits::byte_sequence>(size, fill);
+    SegmentationLayer<SerializedData> packet(
+        SerializedData(body, body->begin(), body->size()));
+
+    std::size_t offset = stream.size();
+    stream.resize(offset + packet.size());
+    packet.fillSerialized(stream.begin() + offset);
+}
+
+// feed the stream to the reader in pieces of at most piece_size bytes,
+// collect all packets
+static std::vector<SerializedData> readStream(
+    SegmentationStreamReader& reader,
+    const byte_traits::byte_sequence& stream,
+    std::size_t piece_size
+)
+{
+    std::vector<SerializedData> packets;
+    std::size_t pos = 0;
+
+    while (pos < stream.size())
+    {
+        boost::asio::mutable_buffers_1 buf = reader.prepare();
+        std::size_t count = std::min(
+            std::min(piece_size, boost::asio::buffer_size(buf)),
+            stream.size() - pos);
+
+        std::memcpy(
+            boost::asio::buffer_cast<void*>(buf), &stream[pos], count);
+        reader.commit(count);
+        pos += count;
+
+        SerializedData packet({}, {}, 0);
+        while (reader.nextPacket(packet))
+            packets.push_back(std::move(packet));
+    }
+
+    return packets;
+}
+
+static bool checkPacket(
+    const SerializedData& packet,
+    std::size_t size,
+    byte_traits::byte_t fill
+)
+{
+    auto it = packet.begin();
+    SegmentationLayerBase::HeaderType header =
+        SegmentationLayerBase::decodeHeader(it);
+
+    if (header.packetsize != packet.size() || header.payloadSize() != size)
+        return false;
+
+    it += header.headerLength();
+    return std::count(it, it + size, fill) == std::ptrdiff_t(size);
+}
+
+int main()
+{
+    byte_traits::byte_sequence stream;
+    appendPacket(stream, 10, 'a');
+    appendPacket(stream, 0, 'b');
+    appendPacket(stream, 300, 'c');
+    appendPacket(stream, 5, 'd');
+    appendPacket(stream, 1000, 'e');
+
+    // many packets in one read, packets split across reads, a small chunk
+    // size so incomplete packets are moved around
+    for (std::size_t piece_size : {std::size_t(1), std::size_t(3),
+        std::size_t(7), std::size_t(100), stream.size()})
+    {
+        SegmentationStreamReader reader(0x8FFF, 128);
+        std::vector<SerializedData> packets =
+            readStream(reader, stream, piece_size);
+
+        TEST_ASSERT(packets.size() == 5);
+        if (packets.size() == 5)
+        {
+            TEST_ASSERT(checkPacket(packets[0], 10, 'a'));
+            TEST_ASSERT(checkPacket(packets[1], 0, 'b'));
+            TEST_ASSERT(checkPacket(packets[2], 300, 'c'));
+            TEST_ASSERT(checkPacket(packets[3], 5, 'd'));
+            TEST_ASSERT(checkPacket(packets[4], 1000, 'e'));
+        }
+    }
+
+    // packets of 64 KiB and more get a version 1 header
+    {
+        byte_traits::byte_sequence big;
+        appendPacket(big, 70000, 'f');
+        appendPacket(big, 20, 'g');
+
+        TEST_ASSERT(SegmentationLayerBase::peekHeaderLength(big.begin())
+            == SegmentationLayerBase::v1_header_length);
+
+        for (std::size_t piece_size : {std::size_t(5), std::size_t(4096)})
+        {
+            SegmentationStreamReader reader(0x20000);
+            std::vector<SerializedData> packets =
+                readStream(reader, big, piece_size);
+
+            TEST_ASSERT(packets.size() == 2);
+            if (packets.size() == 2)
+            {
+                TEST_ASSERT(checkPacket(packets[0], 70000, 'f'));
+                TEST_ASSERT(checkPacket(packets[1], 20, 'g'));
+            }
+        }
+    }
+
+    // oversized packets are rejected
+    {
+        byte_traits::byte_sequence big;
+        appendPacket(big, 200, 'x');
+
+        SegmentationStreamReader reader(100);
+        bool caught = false;
+        try {
+            readStream(reader, big, big.size());
+        }
+        catch (const MsgLayerError&)
+        {
+            caught = true;
+        }
+        TEST_ASSERT(caught);
+    }
+
+    // invalid headers are rejected
+    {
+        byte_traits::byte_sequence garbage(8, 0x42);
+
+        SegmentationStreamReader reader(0x8FFF);
+        bool caught = false;
+        try {
+            readStream(reader, garbage, garbage.size());
+        }
+        catch (const InvalidHeaderError&)
+        {
+            caught = true;
+        }
+        TEST_ASSERT(caught);
+    }
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,87 @@
+// test_slottable.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <algorithm>
+
+#include "slottable.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class SlotTable")
+
+using namespace nuke_ms;
+
+int main()
+{
+    SlotTable<std::string> table;
+    TEST_ASSERT(table.empty());
+
+    SlotTable<std::string>::id_type a = table.insert("a");
+    SlotTable<std::string>::id_type b = table.insert("b");
+    SlotTable<std::string>::id_type c = table.insert("c");
+
+    // identifiers are positive and distinct
+    TEST_ASSERT(a > 0 && b > 0 && c > 0);
+    TEST_ASSERT(a != b && b != c && a != c);
+    TEST_ASSERT(table.size() == 3);
+
+    // lookup
+    TEST_ASSERT(table.find(a) && *table.find(a) == "a");
+    TEST_ASSERT(table.find(b) && *table.find(b) == "b");
+    TEST_ASSERT(table.find(c) && *table.find(c) == "c");
+    TEST_ASSERT(!table.find(0));
+    TEST_ASSERT(!table.find(-1));
+    TEST_ASSERT(!table.find(a + 100));
+
+    // erasing keeps the other elements reachable
+    TEST_ASSERT(table.erase(a));
+    TEST_ASSERT(!table.erase(a));
+    TEST_ASSERT(!table.find(a));
+    TEST_ASSERT(table.size() == 2);
+    TEST_ASSERT(table.find(b) && *table.find(b) == "b");
+    TEST_ASSERT(table.find(c) && *table.find(c) == "c");
+
+    // iteration visits all elements
+    std::string all;
+    for (const std::string& s : table)
+        all += s;
+    std::sort(all.begin(), all.end());
+    TEST_ASSERT(all == "bc");
+
+    // the slot is reused with a new identifier, the old one stays invalid
+    SlotTable<std::string>::id_type d = table.insert("d");
+    TEST_ASSERT(d != a);
+    TEST_ASSERT(!table.find(a));
+    TEST_ASSERT(table.find(d) && *table.find(d) == "d");
+    TEST_ASSERT(table.size() == 3);
+
+    // many insertions and removals
+    for (int round = 0; round < 5000; ++round)
+    {
+        SlotTable<std::string>::id_type id = table.insert("x");
+        TEST_ASSERT(table.find(id) && *table.find(id) == "x");
+        TEST_ASSERT(table.erase(id));
+        TEST_ASSERT(!table.find(id));
+    }
+    TEST_ASSERT(table.size() == 3);
+    TEST_ASSERT(*table.find(b) == "b" && *table.find(c) == "c");
+
+    return CONCLUDE_TEST();
+}
@@ -0,0 +1,179 @@
+// test_dispatcher.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "dispatcher.hpp"
+#include "bufferpool.hpp"
+#include "clientnode/clientnode.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class DispatchingServer")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+using boost::asio::ip::tcp;
+
+static const tcp::endpoint server_endpoint(
+    boost::asio::ip::address_v4::loopback(), 34443);
+
+// a packet whose body is size bytes of fill at the start of a chunk of
+// chunk_size bytes
+static Packet::ptr_t makePacket(
+    std::size_t size,
+    char fill,
+    std::size_t chunk_size
+)
+{
+    auto chunk = std::make_shared<byte_traits::byte_sequence>(
+        chunk_size, static_cast<byte_traits::byte_t>(fill));
+
+    return std::make_shared<const Packet>(
+        SegmentationLayerBase::makeHeader(size),
+        SerializedData(chunk, chunk->begin(), size));
+}
+
+// read one packet with a version 0 header and return its body
+static std::string receiveBody(tcp::socket& socket)
+{
+    byte_traits::byte_t header[SegmentationLayerBase::v0_header_length];
+    boost::asio::read(socket, boost::asio::buffer(header));
+
+    std::string body(
+        SegmentationLayerBase::decodeHeader(header).payloadSize(), '\0');
+    boost::asio::read(socket, boost::asio::buffer(&body[0], body.size()));
+
+    return body;
+}
+
+int main()
+{
+    ServerOptions options;
+    options.thread_count = 1;
+    options.log_level = LogLevel::warning;
+    options.peer_send_limit = options.total_send_limit = 0;
+
+    // the server runs until the process ends
+    DispatchingServer* server = new DispatchingServer(options);
+    boost::thread(boost::bind(&DispatchingServer::run, server)).detach();
+
+    boost::asio::io_service io_service;
+
+    // The server keeps its peers in a SlotTable, so the first connection
+    // gets the first identifier of a new table. Events are injected for it.
+    BasicServerEvent::connection_id_t sender_id =
+        SlotTable<RemotePeer::ptr_t>().insert(RemotePeer::ptr_t());
+
+    tcp::socket sender(io_service);
+    sender.connect(server_endpoint);
+
+    std::vector<std::unique_ptr<tcp::socket>> receivers;
+    for (int i = 0; i < 3; ++i)
+    {
+        receivers.emplace_back(new tcp::socket(io_service));
+        receivers.back()->connect(server_endpoint);
+    }
+
+    // wait until the server has accepted everybody
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // small packets from a chunk are relayed from the chunk, as long as no
+    // recipient is busy
+    {
+        Packet::ptr_t packet = makePacket(10, 'a', BufferPool::max_class_size);
+
+        unsigned long long acquired =
+            BufferPool::instance()->statistics().acquired;
+        server->handleServerEvent(ReceivedMessageEvent(sender_id, packet));
+
+        TEST_ASSERT(BufferPool::instance()->statistics().acquired == acquired);
+
+        for (auto& receiver : receivers)
+            TEST_ASSERT(receiveBody(*receiver) == std::string(10, 'a'));
+    }
+
+    // if the recipients are busy, they share one copy of a small packet and
+    // the chunk is released
+    {
+        // the receivers don't read, so this one is not written completely
+        server->handleServerEvent(ReceivedMessageEvent(sender_id,
+            makePacket(32*1024*1024, 'b', 32*1024*1024)));
+
+        Packet::ptr_t packet = makePacket(10, 'c', BufferPool::max_class_size);
+        std::weak_ptr<const byte_traits::byte_sequence> chunk =
+            packet->body().getOwnership();
+
+        unsigned long long acquired =
+            BufferPool::instance()->statistics().acquired;
+        server->handleServerEvent(ReceivedMessageEvent(sender_id, packet));
+        packet.reset();
+
+        TEST_ASSERT(
+            BufferPool::instance()->statistics().acquired == acquired + 1);
+        TEST_ASSERT(chunk.expired());
+    }
+
+    // a client receives the messages for its user before it has sent one,
+    // the announcement of the user is not relayed
+    {
+        const UniqueUserID user(1234ull);
+
+        tcp::socket bystander(io_service);
+        bystander.connect(server_endpoint);
+
+        std::atomic<bool> received(false);
+        clientnode::ClientNode receiver(
+            clientnode::LoggingStreams(clientnode::LogSeverity::warning));
+        receiver.connectRcvMessage(
+            [&](std::shared_ptr<NearUserMessage> msg)
+            {
+                if (msg->_stringwrap._message_string == "Hi")
+                    received = true;
+            });
+        receiver.setUserId(user);
+        receiver.connectTo(clientnode::ServerLocation{"127.0.0.1 34443"});
+
+        SegmentationLayer<NearUserMessage> msg(
+            NearUserMessage(StringwrapLayer("Hi"), user));
+        byte_traits::byte_sequence data(msg.size());
+        msg.fillSerialized(data.begin());
+
+        // the server may not have learned the user yet, try again until the
+        // message arrives
+        for (int i = 0; i < 40 && !received; ++i)
+        {
+            boost::asio::write(sender, boost::asio::buffer(data));
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+
+        TEST_ASSERT(received);
+        TEST_ASSERT(bystander.available() == 0);
+    }
+
+    return CONCLUDE_TEST();
+}
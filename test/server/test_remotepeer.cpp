@@ -0,0 +1,192 @@
+// test_remotepeer.cpp
+
+/*
+ *   nuke-ms - Nuclear Messaging System
+ *   Copyright (C) 2012  Alexander Korsunsky
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, version 3 of the License.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "remotepeer.hpp"
+#include "segmentationreader.hpp"
+#include "fragmentassembler.hpp"
+
+#include "testutils.hpp"
+
+DECLARE_TEST("class RemotePeer")
+
+using namespace nuke_ms;
+using namespace nuke_ms::server;
+using boost::asio::ip::tcp;
+
+// a packet with size bytes of fill, a fragment if flags are set
+static RemotePeer::packet_ptr_t makePacket(
+    std::size_t size,
+    char fill,
+    byte_traits::byte_t flags = 0,
+    SegmentationLayerBase::stream_id_t stream_id = 0
+)
+{
+    auto data = std::make_shared<byte_traits::byte_sequence>(
+        size, static_cast<byte_traits::byte_t>(fill));
+
+    SegmentationLayerBase::HeaderType header =
+        SegmentationLayerBase::makeHeader(size);
+
+    if (flags)
+    {
+        header.version = 1;
+        header.flags = flags;
+        header.packetsize = SegmentationLayerBase::v1_header_length + size;
+        header.stream_id = stream_id;
+    }
+
+    return std::make_shared<const Packet>(
+        header, SerializedData(data, data->begin(), size));
+}
+
+// a peer connected to a client socket, nothing is written until the
+// io_service is run
+struct Connection
+{
+    boost::asio::io_service io_service;
+    tcp::socket client;
+    ServerStats stats;
+    SendLimits limits;
+    RemotePeer::ptr_t peer;
+
+    Connection(SlowConsumerPolicy policy, std::size_t peer_limit)
+        : client(io_service), limits(policy, peer_limit, 0)
+    {
+        tcp::acceptor acceptor(io_service,
+            tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        boost::shared_ptr<tcp::socket> server(new tcp::socket(io_service));
+
+        client.connect(acceptor.local_endpoint());
+        acceptor.accept(*server);
+
+        peer.reset(new RemotePeer(io_service, server, 1,
+            [](const BasicServerEvent&) {}, stats, limits,
+            SegmentationLayerBase::default_max_packetsize));
+    }
+
+    // write everything, close the connection and return the messages the
+    // client received
+    std::vector<std::string> receive()
+    {
+        io_service.run();
+        io_service.reset();
+
+        peer->shutdownConnection();
+        io_service.run();
+
+        SegmentationStreamReader reader(
+            SegmentationLayerBase::default_max_packetsize);
+        FragmentAssembler assembler;
+        std::vector<std::string> messages;
+
+        boost::system::error_code error;
+        while (true)
+        {
+            std::size_t bytes = client.read_some(reader.prepare(), error);
+            if (error)
+                break;
+
+            reader.commit(bytes);
+
+            SerializedData packet({}, {}, 0), message({}, {}, 0);
+            while (reader.nextPacket(packet))
+                if (assembler.addPacket(packet, message))
+                    messages.push_back(
+                        std::string(message.begin(),
+                            message.begin() + message.size()));
+        }
+
+        return messages;
+    }
+};
+
+int main()
+{
+    const byte_traits::byte_t first = SegmentationLayerBase::FLAG_MORE;
+    const byte_traits::byte_t middle =
+        SegmentationLayerBase::FLAG_MORE | SegmentationLayerBase::FLAG_CONTINUED;
+    const byte_traits::byte_t last = SegmentationLayerBase::FLAG_CONTINUED;
+
+    // with drop_newest, the fragments following a dropped one are dropped,
+    // even if they would fit again
+    {
+        Connection conn(SlowConsumerPolicy::drop_newest, 250);
+
+        conn.peer->sendMessage(makePacket(100, 'a'));
+        conn.peer->sendMessage(makePacket(100, 'b', first, 7));
+        conn.peer->sendMessage(makePacket(100, 'c', middle, 7));
+        conn.peer->sendMessage(makePacket(10, 'd', last, 7));
+        conn.peer->sendMessage(makePacket(10, 'e'));
+
+        std::vector<std::string> messages = conn.receive();
+
+        TEST_ASSERT(messages.size() == 2);
+        TEST_ASSERT(messages[0] == std::string(100, 'a'));
+        TEST_ASSERT(messages[1] == std::string(10, 'e'));
+        TEST_ASSERT(conn.peer->statistics().dropped_packets == 2);
+    }
+
+    // with drop_oldest, the queued fragments behind a dropped one and the
+    // fragments sent later are dropped
+    {
+        Connection conn(SlowConsumerPolicy::drop_oldest, 250);
+
+        // the first fragment is being written and can't be dropped
+        conn.peer->sendMessage(makePacket(100, 'b', first, 7));
+        conn.io_service.poll_one();
+
+        conn.peer->sendMessage(makePacket(100, 'c', middle, 7));
+        conn.peer->sendMessage(makePacket(10, 'x', middle, 7));
+        conn.peer->sendMessage(makePacket(10, 'g'));
+        conn.peer->sendMessage(makePacket(10, 'd', last, 7));
+
+        std::vector<std::string> messages = conn.receive();
+
+        TEST_ASSERT(messages.size() == 1);
+        TEST_ASSERT(messages[0] == std::string(10, 'g'));
+        TEST_ASSERT(conn.peer->statistics().dropped_packets == 3);
+    }
+
+    // a stream is dropped for one message only
+    {
+        Connection conn(SlowConsumerPolicy::drop_newest, 250);
+
+        conn.peer->sendMessage(makePacket(200, 'a'));
+        conn.peer->sendMessage(makePacket(100, 'b', first, 7));
+        conn.peer->sendMessage(makePacket(10, 'c', last, 7));
+
+        conn.io_service.run();
+        conn.io_service.reset();
+
+        conn.peer->sendMessage(makePacket(10, 'd', first, 8));
+        conn.peer->sendMessage(makePacket(10, 'e', last, 8));
+
+        std::vector<std::string> messages = conn.receive();
+
+        TEST_ASSERT(messages.size() == 2);
+        TEST_ASSERT(messages[0] == std::string(200, 'a'));
+        TEST_ASSERT(messages[1] == std::string(10, 'd') + std::string(10, 'e'));
+    }
+
+    return CONCLUDE_TEST();
+}
@@ -35,6 +35,10 @@ DECLARE_TEST("class ConnectedClient")
 
 static const char* OUTSTRING = "Wazzzuuppp???";
 static const char* INSTRING = "Wazzzuuppp!!!";
+static const char* INSTRING2 = "Over and out.";
+
+// too large for a single packet, it is sent in fragments
+static const std::string INSTRING3(200000, 'z');
 
 static std::string data_out_received;
 static std::string data_in_received;
@@ -49,9 +53,17 @@ void receiveCallback(
     std::cout<<"server: Data received: \""<<data_out_received
         <<"\". Sending reply.\n";
 
+    // send two packets back to back, the second one is queued while the
+    // first one is being written
     client->sendPacket(
         SegmentationLayer<StringwrapLayer>{StringwrapLayer{INSTRING}}
     );
+    client->sendPacket(
+        SegmentationLayer<StringwrapLayer>{StringwrapLayer{INSTRING2}}
+    );
+    client->sendPacket(
+        SegmentationLayer<StringwrapLayer>{StringwrapLayer{INSTRING3}}
+    );
 
     client->shutdown();
 }
@@ -130,6 +142,62 @@ void sendMessage(tcp::socket& sock, const std::string& data)
 }
 
 
+std::string receiveString(tcp::socket& sock)
+{
+    // read reply header, the replies are small enough for a version 0
+    // header
+    byte_traits::byte_sequence headerbuf(SegmentationLayerBase::v0_header_length);
+    boost::asio::read(sock, boost::asio::buffer(headerbuf));
+
+    TEST_ASSERT(SegmentationLayerBase::peekHeaderLength(headerbuf.begin())
+        == SegmentationLayerBase::v0_header_length);
+
+    SegmentationLayerBase::HeaderType header =
+        SegmentationLayerBase::decodeHeader(headerbuf.begin());
+
+    // read reply body
+    auto bodybuf = std::make_shared<byte_traits::byte_sequence>(
+        header.payloadSize()
+    );
+    boost::asio::read(sock, boost::asio::buffer(*bodybuf));
+
+    StringwrapLayer in_data(
+        SerializedData{bodybuf, bodybuf->begin(), bodybuf->size()}
+    );
+
+    return in_data._message_string;
+}
+
+
+std::string receiveFragmentedString(tcp::socket& sock)
+{
+    SegmentationStreamReader reader(
+        SegmentationLayerBase::default_max_packetsize);
+    FragmentAssembler assembler;
+    SerializedData packet({}, {}, 0), message({}, {}, 0);
+    std::size_t fragments = 0;
+
+    while (true)
+    {
+        reader.commit(sock.read_some(reader.prepare()));
+
+        while (reader.nextPacket(packet))
+        {
+            ++fragments;
+
+            // no packet may be larger than the receiver accepts
+            TEST_ASSERT(packet.size()
+                <= SegmentationLayerBase::default_max_packetsize);
+
+            if (assembler.addPacket(packet, message))
+            {
+                TEST_ASSERT(fragments > 1);
+                return StringwrapLayer(message)._message_string;
+            }
+        }
+    }
+}
+
 
 int main()
 {
@@ -165,39 +233,21 @@ int main()
     // send message to the "server"
     sendMessage(con_socket, OUTSTRING);
 
-    // read reply header
-    byte_traits::byte_t headerbuf[SegmentationLayerBase::header_length];
-    boost::asio::read(
-        con_socket,
-        boost::asio::buffer(headerbuf, SegmentationLayerBase::header_length)
-    );
-
-	byte_traits::uint2b_t packetsize;
-	readbytes(&packetsize, headerbuf+1);
-    packetsize = to_hostbo(packetsize);
-
-    TEST_ASSERT(
-        packetsize == SegmentationLayerBase::header_length + strlen(INSTRING)
-    );
-
-    // read reply body
-    auto bodybuf = std::make_shared<byte_traits::byte_sequence>(
-        packetsize-SegmentationLayerBase::header_length
-    );
-    boost::asio::read(con_socket, boost::asio::buffer(*bodybuf));
-
-    StringwrapLayer in_data(
-        SerializedData{bodybuf, bodybuf->begin(), bodybuf->size()}
-    );
+    // read replies, they must arrive in the order they were sent
+    std::string in_data = receiveString(con_socket);
+    std::string in_data2 = receiveString(con_socket);
+    std::string in_data3 = receiveFragmentedString(con_socket);
 
-    std::cout<<"Reply received: \""<<in_data._message_string<<"\".\n";
+    std::cout<<"Replies received: \""<<in_data<<"\", \""<<in_data2<<"\".\n";
 
     // shut down servers
     server.shutdown();
     server_thread.join();
 
     // verify data integrity
-    TEST_ASSERT(in_data._message_string == INSTRING);
+    TEST_ASSERT(in_data == INSTRING);
+    TEST_ASSERT(in_data2 == INSTRING2);
+    TEST_ASSERT(in_data3 == INSTRING3);
     TEST_ASSERT(data_out_received == OUTSTRING);
 
     return CONCLUDE_TEST();